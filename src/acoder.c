@@ -19,204 +19,188 @@
 	HA arithmetic coder
 ***********************************************************************/
 
-/***********************************************************************
-This file contains some small changes made by Nico de Vries (AIP-NL)
-allowing it to be compiled with Borland C++ 3.1.
-***********************************************************************/
-
-
 #include <stdlib.h>
 #include <stdio.h>
 #include "ha.h"
 #include "haio.h"
+#include "codec.h"
 #include "acoder.h"
 
-static U16B h,l,v;
-static S16B s;
-static S16B gpat,ppat;
-
 /***********************************************************************
   Bit I/O
 ***********************************************************************/
 
-#define putbit(b) 	{ ppat<<=1;				\
-			  if (b) ppat|=1;			\
-			  if (ppat&0x100) {			\
-				putbyte(ppat&0xff);		\
-				ppat=1;				\
-			  }					\
+#define putbit(cx,b) 	{ (cx)->ac.ppat<<=1;				\
+			  if (b) (cx)->ac.ppat|=1;			\
+			  if ((cx)->ac.ppat&0x100) {			\
+				putbyte(&(cx)->io,(cx)->ac.ppat&0xff);	\
+				(cx)->ac.ppat=1;			\
+			  }						\
 			}
 
 
-#define getbit(b) 	{ gpat<<=1;				\
-			  if (!(gpat&0xff)) {			\
-				gpat=getbyte();			\
-				if (gpat&0x100) gpat=0x100;	\
-				else {				\
-					gpat<<=1;		\
-					gpat|=1;		\
-				}				\
-			  }					\
-			  b|=(gpat&0x100)>>8;			\
+#define getbit(cx,b) 	{ (cx)->ac.gpat<<=1;				\
+			  if (!((cx)->ac.gpat&0xff)) {			\
+				(cx)->ac.gpat=getbyte(&(cx)->io);	\
+				if ((cx)->ac.gpat&0x100)		\
+					(cx)->ac.gpat=0x100;		\
+				else {					\
+					(cx)->ac.gpat<<=1;		\
+					(cx)->ac.gpat|=1;		\
+				}					\
+			  }						\
+			  b|=((cx)->ac.gpat&0x100)>>8;			\
 			}
 
 
 /***********************************************************************
-  Arithmetic encoding
+  Range coder
+
+  Used for archive version 3 and newer. Keeps 32 bits of precision
+  and moves whole bytes. The carry out of low is held back in cache
+  and pending (a run of 0xff bytes) until it is known.
 ***********************************************************************/
 
-#ifndef __BORLANDC__
+#define RC_MASK		0xffffffffUL
+#define RC_TOP		(1UL<<24)
 
-void ac_out(U16B low, U16B high, U16B tot)
+static void rc_shift(Codec *cx)
 {
 
-    register U32B r;
+    register Acoder *ac=&cx->ac;
 
-    r=(U32B)(h-l)+1;
-    h=(U16B)(r*high/tot-1)+l;
-    l+=(U16B)(r*low/tot);
-    if (!((h^l)&0x8000))
+    if (ac->low<0xff000000UL || ac->carry)
     {
-        putbit(l&0x8000);
-        while(s)
-        {
-            --s;
-            putbit(~l&0x8000);
-        }
-        l<<=1;
-        h<<=1;
-        h|=1;
-        while (!((h^l)&0x8000))
-        {
-            putbit(l&0x8000);
-            l<<=1;
-            h<<=1;
-            h|=1;
-        }
-    }
-    while ((l&0x4000)&&!(h&0x4000))
-    {
-        ++s;
-        l<<=1;
-        l&=0x7fff;
-        h<<=1;
-        h|=0x8001;
+        if (ac->cache>=0) putbyte(&cx->io,(ac->cache+ac->carry)&0xff);
+        for (; ac->pending; --ac->pending)
+            putbyte(&cx->io,(0xff+ac->carry)&0xff);
+        ac->cache=(int)(ac->low>>24);
+        ac->carry=0;
     }
+    else ++ac->pending;
+    ac->low=(ac->low<<8)&RC_MASK;
 }
 
-#else
-
-void ac_out(U16B low, U16B high, U16B tot)
+static void rc_out(Codec *cx, U16B low, U16B high, U16B tot)
 {
 
-    asm
-    {
-        mov ax,h
-        mov bx,l
-        sub ax,bx
-        add ax,1
-        mov cx,ax
-        jc  aco0
-        mul high
-        jmp aco1
-    }
-aco0:
-    asm
-    {
-        mov dx,high
-    }
-aco1:
-    asm
-    {
-        cmp dx,tot
-        je  aco2
-        div tot
-        sub ax,1
-        jmp aco3
-    }
-aco2:
-    asm
-    {
-        mov ax,0xffff
-    }
-aco3:
-    asm
+    register U32B r,t;
+    register Acoder *ac=&cx->ac;
+
+    r=ac->range/tot;
+    t=(ac->low+r*low)&RC_MASK;
+    if (t<ac->low) ac->carry=1;
+    ac->low=t;
+    ac->range=r*(high-low);
+    while (ac->range<RC_TOP)
     {
-        add ax,bx
-        mov h,ax
-        mov ax,cx
-        cmp ax,0
-        je  aco4
-        mul low
-        jmp aco5
+        ac->range<<=8;
+        rc_shift(cx);
     }
-aco4:
-    asm
+}
+
+static void rc_in(Codec *cx, U16B low, U16B high, U16B tot)
+{
+
+    register U32B r;
+    register Acoder *ac=&cx->ac;
+
+    r=ac->range/tot;
+    ac->code-=r*low;
+    ac->range=r*(high-low);
+    while (ac->range<RC_TOP)
     {
-        mov dx,low
+        ac->range<<=8;
+        ac->code=((ac->code<<8)|(getbyte(&cx->io)&0xff))&RC_MASK;
     }
-aco5:
-    asm
+}
+
+
+/***********************************************************************
+  Arithmetic encoding
+***********************************************************************/
+
+void ac_out(Codec *cx, U16B low, U16B high, U16B tot)
+{
+
+    register U32B r;
+    register Acoder *ac=&cx->ac;
+
+    if (cx->coder==AC_RANGE)
     {
-        div tot
-        add l,ax
+        rc_out(cx,low,high,tot);
+        return;
     }
-    if (!((h^l)&0x8000))
+    r=(U32B)(ac->h-ac->l)+1;
+    ac->h=(U16B)(r*high/tot-1)+ac->l;
+    ac->l+=(U16B)(r*low/tot);
+    if (!((ac->h^ac->l)&0x8000))
     {
-        putbit(l&0x8000);
-        while(s)
+        putbit(cx,ac->l&0x8000);
+        while(ac->s)
         {
-            --s;
-            putbit(~l&0x8000);
+            --ac->s;
+            putbit(cx,~ac->l&0x8000);
         }
-        l<<=1;
-        h<<=1;
-        h|=1;
-        while (!((h^l)&0x8000))
+        ac->l<<=1;
+        ac->h<<=1;
+        ac->h|=1;
+        while (!((ac->h^ac->l)&0x8000))
         {
-            putbit(l&0x8000);
-            l<<=1;
-            h<<=1;
-            h|=1;
+            putbit(cx,ac->l&0x8000);
+            ac->l<<=1;
+            ac->h<<=1;
+            ac->h|=1;
         }
     }
-    while ((l&0x4000)&&!(h&0x4000))
+    while ((ac->l&0x4000)&&!(ac->h&0x4000))
     {
-        ++s;
-        l<<=1;
-        l&=0x7fff;
-        h<<=1;
-        h|=0x8001;
+        ++ac->s;
+        ac->l<<=1;
+        ac->l&=0x7fff;
+        ac->h<<=1;
+        ac->h|=0x8001;
     }
 }
 
-#endif
-
-void ac_init_encode(void)
+void ac_init_encode(Codec *cx)
 {
 
-    h=0xffff;
-    l=s=0;
-    ppat=1;
+    cx->ac.low=cx->ac.pending=0;
+    cx->ac.range=RC_MASK;
+    cx->ac.cache=-1;
+    cx->ac.carry=0;
+    cx->ac.h=0xffff;
+    cx->ac.l=cx->ac.s=0;
+    cx->ac.ppat=1;
 }
 
-void ac_end_encode(void)
+void ac_end_encode(Codec *cx)
 {
 
-    ++s;
-    putbit(l&0x4000);
-    while (s--)
+    register Acoder *ac=&cx->ac;
+    int i;
+
+    if (cx->coder==AC_RANGE)
+    {
+        for (i=0; i<5; ++i) rc_shift(cx);
+        flush(&cx->io);
+        return;
+    }
+    ++ac->s;
+    putbit(cx,ac->l&0x4000);
+    while (ac->s--)
     {
-        putbit(~l&0x4000);
+        putbit(cx,~ac->l&0x4000);
     }
-    if (ppat==1)
+    if (ac->ppat==1)
     {
-        flush();
+        flush(&cx->io);
         return;
     }
-    while(!(ppat&0x100)) ppat<<=1;
-    putbyte(ppat&0xff);
-    flush();
+    while(!(ac->ppat&0x100)) ac->ppat<<=1;
+    putbyte(&cx->io,ac->ppat&0xff);
+    flush(&cx->io);
 }
 
 
@@ -224,177 +208,70 @@ void ac_end_encode(void)
   Arithmetic decoding
 ***********************************************************************/
 
-#ifndef __BORLANDC__
-
-void ac_in(U16B low, U16B high, U16B tot)
+void ac_in(Codec *cx, U16B low, U16B high, U16B tot)
 {
 
     register U32B r;
+    register Acoder *ac=&cx->ac;
 
-    r=(U32B)(h-l)+1;
-    h=(U16B)(r*high/tot-1)+l;
-    l+=(U16B)(r*low/tot);
-    while (!((h^l)&0x8000))
+    if (cx->coder==AC_RANGE)
     {
-        l<<=1;
-        h<<=1;
-        h|=1;
-        v<<=1;
-        getbit(v);
+        rc_in(cx,low,high,tot);
+        return;
+    }
+    r=(U32B)(ac->h-ac->l)+1;
+    ac->h=(U16B)(r*high/tot-1)+ac->l;
+    ac->l+=(U16B)(r*low/tot);
+    while (!((ac->h^ac->l)&0x8000))
+    {
+        ac->l<<=1;
+        ac->h<<=1;
+        ac->h|=1;
+        ac->v<<=1;
+        getbit(cx,ac->v);
     }
-    while ((l&0x4000)&&!(h&0x4000))
+    while ((ac->l&0x4000)&&!(ac->h&0x4000))
     {
-        l<<=1;
-        l&=0x7fff;
-        h<<=1;
-        h|=0x8001;
-        v<<=1;
-        v^=0x8000;
-        getbit(v);
+        ac->l<<=1;
+        ac->l&=0x7fff;
+        ac->h<<=1;
+        ac->h|=0x8001;
+        ac->v<<=1;
+        ac->v^=0x8000;
+        getbit(cx,ac->v);
     }
 }
 
-U16B ac_threshold_val(U16B tot)
+U16B ac_threshold_val(Codec *cx, U16B tot)
 {
 
     register U32B r;
+    register Acoder *ac=&cx->ac;
 
-    r=(U32B)(h-l)+1;
-    return (U16B)((((U32B)(v-l)+1)*tot-1)/r);
-}
-
-#else
-
-void ac_in(U16B low, U16B high, U16B tot)
-{
-
-    asm
-    {
-        mov ax,h
-        mov bx,l
-        sub ax,bx
-        add ax,1
-        mov cx,ax
-        jc  aci0
-        mul high
-        jmp aci1
-    }
-aci0:
-    asm
+    if (cx->coder==AC_RANGE)
     {
-        mov dx,high
-    }
-aci1:
-    asm
-    {
-        cmp dx,tot
-        je  aci2
-        div tot
-        sub ax,1
-        jmp aci3
-    }
-aci2:
-    asm
-    {
-        mov ax,0xffff
-    }
-aci3:
-    asm
-    {
-        add ax,bx
-        mov h,ax
-        mov ax,cx
-        cmp ax,0
-        je  aci4
-        mul low
-        jmp aci5
-    }
-aci4:
-    asm
-    {
-        mov dx,low
-    }
-aci5:
-    asm
-    {
-        div tot
-        add l,ax
-    }
-    while (!((h^l)&0x8000))
-    {
-        l<<=1;
-        h<<=1;
-        h|=1;
-        v<<=1;
-        getbit(v);
-    }
-    while ((l&0x4000)&&!(h&0x4000))
-    {
-        l<<=1;
-        l&=0x7fff;
-        h<<=1;
-        h|=0x8001;
-        v<<=1;
-        v^=0x8000;
-        getbit(v);
+        r=ac->code/(ac->range/tot);
+        return (U16B)(r<tot?r:tot-1);
     }
+    r=(U32B)(ac->h-ac->l)+1;
+    return (U16B)((((U32B)(ac->v-ac->l)+1)*tot-1)/r);
 }
 
-U16B ac_threshold_val(U16B tot)
+void ac_init_decode(Codec *cx)
 {
 
-    U16B rv;
+    int i;
 
-    asm
-    {
-        mov ax,h
-        sub ax,l
-        add ax,1
-        jc  atv1
-        mov cx,ax
-        mov ax,v
-        sub ax,l
-        inc ax
-        mul [tot]
-        sub ax,1
-        sbb dx,0
-        div cx
-        mov rv,ax
-        jmp atv3
-    }
-atv1:
-    asm
-    {
-        mov ax,v
-        sub ax,l
-        add ax,1
-        jc  atv2
-        mul [tot]
-        sub ax,1
-        sbb dx,0
-        mov rv,dx
-        jmp atv3
-    }
-atv2:
-    asm
+    if (cx->coder==AC_RANGE)
     {
-        mov ax,tot
-        dec ax
-        mov rv,dx
+        cx->ac.range=RC_MASK;
+        for (cx->ac.code=i=0; i<4; ++i)
+            cx->ac.code=(cx->ac.code<<8)|(getbyte(&cx->io)&0xff);
+        return;
     }
-atv3:
-    return rv;
-}
-
-#endif
-
-void ac_init_decode(void)
-{
-
-    h=0xffff;
-    l=0;
-    gpat=0;
-    v=getbyte()<<8;
-    v|=0xff&getbyte();
+    cx->ac.h=0xffff;
+    cx->ac.l=0;
+    cx->ac.gpat=0;
+    cx->ac.v=getbyte(&cx->io)<<8;
+    cx->ac.v|=0xff&getbyte(&cx->io);
 }
-
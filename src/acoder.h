@@ -19,10 +19,9 @@
 	HA arithmetic coder
 ***********************************************************************/
 
-void ac_init_encode(void);
-void ac_end_encode(void);
-void ac_init_decode(void);
-void ac_out(U16B low, U16B high, U16B tot);
-U16B ac_threshold_val(U16B tot);
-void ac_in(U16B low, U16B high, U16B tot);
-
+void ac_init_encode(Codec *cx);
+void ac_end_encode(Codec *cx);
+void ac_init_decode(Codec *cx);
+void ac_out(Codec *cx, U16B low, U16B high, U16B tot);
+U16B ac_threshold_val(Codec *cx, U16B tot);
+void ac_in(Codec *cx, U16B low, U16B high, U16B tot);
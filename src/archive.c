@@ -27,15 +27,62 @@
 #include "archive.h"
 #include "haio.h"
 
-#define STRING	32
+#define HDRFIXED	17		/* Header up to path		*/
+#define HDRWIDE		25		/*   with 8 byte lengths	*/
+#define DEADWIDE	0xfe		/* Deleted mark of wide header	*/
+#define ISDEAD(b)	((b)==0xff || (b)==DEADWIDE)
+#define WIDE(b)		((b)==DEADWIDE || ((b)!=0xff && (b)>>4>=WIDEVER))
+#define LENBYTES(b)	(WIDE(b)?8:4)
+#define FIXLEN(b)	(WIDE(b)?HDRWIDE:HDRFIXED)
+#define COUNTMAX	0xffff		/* Count field means "or more"	*/
+#define SCANWIN		(64UL<<10)	/* Read window of header scan	*/
+#define IDXID		"HAI4"		/* Index trailer identifier	*/
+#define TRAILLEN	20		/* Index trailer length		*/
+#define NOMEMBER	((unsigned)-1)
+#define HOLEFRAC	8		/* Compact if holes waste 1/8	*/
+#define MOVEMAX		(16UL<<20)	/* Compact if this moves less	*/
+#define DEAD(i)		ISDEAD(mtab[i].hdr[0])
+#define TYPE(i)		(mtab[i].hdr[0]&0xf)	/* Of a live member	*/
+#define SOLIDREF	24		/* Data of a solid member	*/
+#define HOLEHDR		(HDRWIDE+3)	/* Header of a filler hole	*/
+
+/*	Members are kept in memory in archive order with their headers
+	as stored in the archive. The table is loaded from the index at
+	the end of the archive when there is a valid one, else by
+	scanning the headers. A deleted member stays as a hole (a header
+	marked with 0xff or DEADWIDE) until the archive is compacted. Live members
+	are also chained in htab by path and name.
+
+	A solid block is a hidden member of type M_BLOCK named by its id
+	(hex path, empty name). Solid members refer to it by that id and
+	it is dropped when the last of them is gone.
+*/
+
+typedef struct
+{
+    U32B pos;				/* Header position		*/
+    U32B clen;
+    unsigned hlen;
+    unsigned char *hdr;
+    unsigned next;			/* Next in hash chain		*/
+} Member;
 
 int arcfile=-1;
 char *arcname=NULL;
 struct stat arcstat;
 static unsigned arccnt=0;
-static int dirty=0,addtries;
-static U32B nextheader=4,thisheader,arcsize,bestpos,trypos;
+static int dirty=0,changed=0,rdonly=0,addtries;
+static int solidgone;			/* A solid member was deleted	*/
+static U32B nextblock;			/* Id for a new block, 0 unknown */
+static U32B arcsize,bestpos,trypos,datapos,deadlen;
 static Fheader newhdr;
+static unsigned char *cpybuf=NULL;
+static Member *mtab=NULL;
+static unsigned mcnt=0,mmax=0,mnext=0,mthis;
+static unsigned *htab=NULL,hsize=0;
+static unsigned char *win=NULL;		/* Header scan window		*/
+static U32B wpos,wlen,wsize;
+static unsigned char idxtrail[TRAILLEN];	/* As read by idxpos()	*/
 
 static U32B getvalue(int len)
 {
@@ -45,55 +92,242 @@ static U32B getvalue(int len)
     int i;
 
     if (read(arcfile,buf,len)!=len) error(1,ERR_READ,arcname);
-    for (val=i=0; i<len; ++i) val|=(U32B)buf[i]<<(i<<3);
+    for (val=0,i=len; i--;) val=(val<<8)|buf[i];
     return val;
 }
 
-static void putvalue(U32B val, int len)
+/*	Version 4 fields are 8 bytes. Where U32B is narrower (32 bit
+	builds) a value that does not fit stops HA instead of being cut.
+*/
+
+static U32B getval(unsigned char *buf, int len)
+{
+
+    U32B val;
+    int i;
+
+    for (val=0,i=len; i--;)
+    {
+        if (i>=(int)sizeof(U32B) && buf[i]) error(1,ERR_TOOBIG,arcname);
+        val=(val<<8)|buf[i];
+    }
+    return val;
+}
+
+static void setval(unsigned char *buf, U32B val, int len)
 {
 
-    unsigned char buf[4];
     int i;
 
     for (i=0; i<len; ++i,val>>=8) buf[i]=(unsigned char) val&0xff;
-    if (write(arcfile,&buf,len)!=len) error(1,ERR_WRITE,arcname);
 }
 
-static char *getstring(void)
+/*	Archive offsets past 4 GB need a 64 bit U32B, stop rather than wrap */
+
+static U32B addpos(U32B pos, U32B len)
 {
 
-    char *sptr;
-    int offset;
+    if (pos+len<pos) error(1,ERR_TOOBIG,arcname);
+    return pos+len;
+}
+
+static void putcount(void)		/* Member count at offset 2	*/
+{
+
+    unsigned char buf[2];
+    unsigned cnt;
+
+    cnt=arccnt<COUNTMAX?arccnt:COUNTMAX;
+    buf[0]=cnt&0xff;
+    buf[1]=(cnt>>8)&0xff;
+    if (pwrite(arcfile,buf,2,(off_t)2)!=2) error(1,ERR_WRITE,arcname);
+}
+
+static void putmark(unsigned i)		/* Mark member i deleted	*/
+{
+
+    mtab[i].hdr[0]=WIDE(mtab[i].hdr[0])?DEADWIDE:0xff;
+    if (pwrite(arcfile,mtab[i].hdr,1,(off_t)mtab[i].pos)!=1)
+        error(1,ERR_WRITE,arcname);
+}
 
-    if ((sptr=malloc(STRING))==NULL) error(1,ERR_MEM,"getstring()");
-    for (offset=0;; offset++)
+/*	Move len bytes of archive data from from to to (to<from), in
+	the kernel if possible, else in blocks of the I/O buffer size.
+*/
+
+static void movedata(U32B from, U32B to, U32B len)
+{
+
+    U32B n;
+    int got;
+
+    n=md_copyrange(arcfile,from,to,len);
+    from+=n;
+    to+=n;
+    if (!(len-=n)) return;
+    if (cpybuf==NULL && (cpybuf=malloc(getiosize()))==NULL)
+        error(1,ERR_MEM,"movedata()");
+    for (; len; len-=got,from+=got,to+=got)
     {
-        if (read(arcfile,sptr+offset,1)!=1) error(1,ERR_READ,arcname);
-        if (sptr[offset]==0) break;
-        if ((offset&(STRING-1))==0)
-        {
-            if ((sptr=realloc(sptr,STRING))==NULL)
-                error(1,ERR_MEM,"getstring()");
-        }
+        n=getiosize()<len?getiosize():len;
+        if ((got=pread(arcfile,cpybuf,n,(off_t)from))<=0)
+            error(1,ERR_READ,arcname);
+        if (pwrite(arcfile,cpybuf,got,(off_t)to)!=got)
+            error(1,ERR_WRITE,arcname);
     }
-    return sptr;
 }
 
-static void putstring(char *string)
+static unsigned hashkey(char *path, char *name)
 {
 
-    int len;
+    register unsigned h;
 
-    len=strlen(string)+1;
-    if (write(arcfile,string,len)!=len) error(1,ERR_WRITE,arcname);
+    for (h=0; *path; ++path) h=h*31+(unsigned char)*path;
+    for (h=h*31; *name; ++name) h=h*31+(unsigned char)*name;
+    return h&(hsize-1);
 }
 
-static Fheader *getheader(void)
+static char *hdrpath(Member *m)
+{
+
+    return (char*)m->hdr+FIXLEN(m->hdr[0]);
+}
+
+static char *hdrname(Member *m)
+{
+
+    return hdrpath(m)+strlen(hdrpath(m))+1;
+}
+
+static void hashin(unsigned i)
+{
+
+    unsigned *h;
+
+    h=&htab[hashkey(hdrpath(&mtab[i]),hdrname(&mtab[i]))];
+    mtab[i].next=*h;
+    *h=i;
+}
+
+static void hashout(unsigned i)
+{
+
+    unsigned *h;
+
+    h=&htab[hashkey(hdrpath(&mtab[i]),hdrname(&mtab[i]))];
+    while (*h!=i) h=&mtab[*h].next;
+    *h=mtab[i].next;
+}
+
+static void rehash(void)
+{
+
+    unsigned i;
+
+    for (i=256; i<2*mcnt; i<<=1);
+    if (i!=hsize)
+    {
+        if ((htab=realloc(htab,i*sizeof(unsigned)))==NULL)
+            error(1,ERR_MEM,"rehash()");
+        hsize=i;
+    }
+    for (i=0; i<hsize; ++i) htab[i]=NOMEMBER;
+    for (i=0; i<mcnt; ++i) if (!DEAD(i)) hashin(i);
+}
+
+static void addmember(U32B pos, unsigned char *hdr, unsigned hlen,
+                      U32B clen)
+{
+
+    if (mcnt==mmax)
+    {
+        mmax=mmax?mmax<<1:256;
+        if ((mtab=realloc(mtab,mmax*sizeof(Member)))==NULL)
+            error(1,ERR_MEM,"addmember()");
+    }
+    mtab[mcnt].pos=pos;
+    mtab[mcnt].clen=clen;
+    mtab[mcnt].hlen=hlen;
+    mtab[mcnt++].hdr=hdr;
+    if (DEAD(mcnt-1)) deadlen+=hlen+clen;
+    else if (mcnt>hsize) rehash();
+    else hashin(mcnt-1);
+}
+
+static void delmember(unsigned i)
+{
+
+    if (TYPE(i)==M_SOLID) solidgone=1;
+    hashout(i);
+    putmark(i);
+    deadlen+=mtab[i].hlen+mtab[i].clen;
+    --arccnt;
+    changed=1;
+}
+
+static void freemembers(void)
+{
+
+    while (mcnt) free(mtab[--mcnt].hdr);
+    deadlen=0;
+    rehash();
+}
+
+/*	First member with exactly path and name, NOMEMBER if none */
+
+static unsigned findmember(char *path, char *name)
+{
+
+    unsigned i;
+
+    if (!hsize) return NOMEMBER;
+    for (i=htab[hashkey(path,name)]; i!=NOMEMBER; i=mtab[i].next)
+    {
+        if (!strcmp(hdrpath(&mtab[i]),path) &&
+                !strcmp(hdrname(&mtab[i]),name)) break;
+    }
+    return i;
+}
+
+static char *getstring(char *old, unsigned char *src)
+{
+
+    char *sptr;
+
+    if (old!=NULL) free(old);
+    if ((sptr=malloc(strlen((char*)src)+1))==NULL)
+        error(1,ERR_MEM,"getstring()");
+    return strcpy(sptr,(char*)src);
+}
+
+/*	Length of the header at buf, 0 if it does not end within len
+	bytes.
+*/
+
+static unsigned hdrlen(unsigned char *buf, U32B len)
+{
+
+    U32B i;
+    int strings;
+
+    if (len<HDRFIXED || len<FIXLEN(buf[0])) return 0;
+    for (i=FIXLEN(buf[0]),strings=0; strings<2; ++i)
+    {
+        if (i>=len) return 0;
+        if (buf[i]==0) ++strings;
+    }
+    if (i>=len || i+1+buf[i]>len) return 0;
+    return (unsigned)(i+1+buf[i]);
+}
+
+static Fheader *getheader(unsigned char *buf)
 {
 
     static Fheader hd= {0,0,0,0,0,0,NULL,NULL,0};
+    unsigned char *p;
+    int n;
 
-    if ((hd.ver=getvalue(1))!=0xff)
+    if (!ISDEAD(hd.ver=buf[0]))
     {
         hd.type=hd.ver&0xf;
         hd.ver>>=4;
@@ -102,74 +336,262 @@ static Fheader *getheader(void)
         if (hd.type!=M_SPECIAL && hd.type!=M_DIR && hd.type>=M_UNK)
             error(1,ERR_UNKMET,hd.type);
     }
-    hd.clen=getvalue(4);
-    hd.olen=getvalue(4);
-    hd.crc=getvalue(4);
-    hd.time=getvalue(4);
-    if (hd.path!=NULL) free(hd.path);
-    hd.path=getstring();
-    if (hd.name!=NULL) free(hd.name);
-    hd.name=getstring();
-    hd.mdilen=(unsigned)getvalue(1);
-    hd.mylen=hd.mdilen+20+strlen(hd.path)+strlen(hd.name);
-    md_gethdr(hd.mdilen,hd.type);
+    n=LENBYTES(buf[0]);
+    hd.clen=getval(buf+1,n);
+    hd.olen=getval(buf+1+n,n);
+    hd.crc=getval(buf+1+2*n,4);
+    hd.time=getval(buf+5+2*n,4);
+    p=buf+FIXLEN(buf[0]);
+    hd.path=getstring(hd.path,p);
+    p+=strlen(hd.path)+1;
+    hd.name=getstring(hd.name,p);
+    p+=strlen(hd.name)+1;
+    hd.mdilen=*p++;
+    hd.mylen=p-buf+hd.mdilen;
+    md_gethdr(p,hd.mdilen,hd.type);
     return &hd;
 }
 
-static void putheader(Fheader *hd)
-{
-
-    putvalue((hd->ver<<4)|hd->type,1);
-    putvalue(hd->clen,4);
-    putvalue(hd->olen,4);
-    putvalue(hd->crc,4);
-    putvalue(hd->time,4);
-    putstring(hd->path);
-    putstring(hd->name);
-    putvalue(hd->mdilen,1);
-    md_puthdr();
-}
+/*	Headers are scanned through a window of the archive, so that
+	archives of small members are read in a few large blocks.
+*/
 
-static void arc_clean(void)
+static unsigned char *readheader(U32B pos, unsigned *hlen)
 {
 
-    U32B ipos,opos,cpylen;
-    int len;
-    unsigned cnt;
-    Fheader *hd;
+    unsigned char *buf;
+    int got;
 
-    ipos=opos=4;
-    for (cnt=arccnt; cnt; --cnt)
+    if (win==NULL || pos<wpos || pos>=wpos+wlen ||
+            (*hlen=hdrlen(win+pos-wpos,wpos+wlen-pos))==0)
     {
-        if (lseek(arcfile,ipos,SEEK_SET)<0) error(1,ERR_SEEK,"arc_clean()");
         for (;;)
         {
-            hd=getheader();
-            if (hd->ver!=0xff) break;
-            ipos+=hd->clen+hd->mylen;
-            if (lseek(arcfile,ipos,SEEK_SET)<0)
-                error(1,ERR_SEEK,"arc_clean()");
+            if (win==NULL && (win=malloc(wsize=SCANWIN))==NULL)
+                error(1,ERR_MEM,"readheader()");
+            if ((got=pread(arcfile,win,wsize,(off_t)pos))<0)
+                error(1,ERR_READ,arcname);
+            wpos=pos;
+            wlen=got;
+            if ((*hlen=hdrlen(win,wlen))!=0) break;
+            if (wlen<wsize) error(1,ERR_READ,arcname);
+            if ((win=realloc(win,wsize<<=1))==NULL)
+                error(1,ERR_MEM,"readheader()");
         }
-        if (ipos==opos) ipos=opos+=hd->clen+hd->mylen;
-        else
+    }
+    if ((buf=malloc(*hlen))==NULL) error(1,ERR_MEM,"readheader()");
+    return memcpy(buf,win+pos-wpos,*hlen);
+}
+
+static void endscan(void)
+{
+
+    if (win!=NULL) free(win),win=NULL;
+}
+
+/*	Write hd at pos and return it as written */
+
+static unsigned char *putheader(Fheader *hd, U32B pos)
+{
+
+    unsigned char *buf,*p;
+    int n;
+
+    if ((buf=malloc(hd->mylen))==NULL) error(1,ERR_MEM,"putheader()");
+    buf[0]=(hd->ver<<4)|hd->type;
+    n=LENBYTES(buf[0]);
+    setval(buf+1,hd->clen,n);
+    setval(buf+1+n,hd->olen,n);
+    setval(buf+1+2*n,hd->crc,4);
+    setval(buf+5+2*n,hd->time,4);
+    p=buf+FIXLEN(buf[0]);
+    strcpy((char*)p,hd->path);
+    p+=strlen(hd->path)+1;
+    strcpy((char*)p,hd->name);
+    p+=strlen(hd->name)+1;
+    *p++=hd->mdilen;
+    if (hd->mdilen) md_puthdr(p);
+    if (pwrite(arcfile,buf,hd->mylen,(off_t)pos)!=hd->mylen)
+        error(1,ERR_WRITE,arcname);
+    return buf;
+}
+
+/*	Index: for each member or hole its header position (8 bytes) and
+	header. The trailer holds the index position, the member count
+	and the CRC-32 of the index.
+*/
+
+static void putindex(void)
+{
+
+    unsigned char *buf,*p;
+    U32B len,end;
+    unsigned i;
+
+    for (len=TRAILLEN,i=0; i<mcnt; ++i) len+=8+mtab[i].hlen;
+    if ((buf=malloc(len))==NULL) error(1,ERR_MEM,"putindex()");
+    for (p=buf,i=0; i<mcnt; ++i)
+    {
+        setval(p,mtab[i].pos,8);
+        memcpy(p+8,mtab[i].hdr,mtab[i].hlen);
+        p+=8+mtab[i].hlen;
+    }
+    setval(p,arcsize,8);
+    setval(p+8,arccnt,4);
+    setval(p+12,crc32upd(0,buf,len-TRAILLEN),4);
+    memcpy(p+16,IDXID,4);
+    end=addpos(arcsize,len);
+    if (pwrite(arcfile,buf,len,(off_t)arcsize)!=len)
+        error(1,ERR_WRITE,arcname);
+    md_truncfile(arcfile,end);
+    free(buf);
+}
+
+/*	Position of the index of an archive of size bytes as given by
+	its trailer, 0 if there is none.
+*/
+
+static U32B idxpos(U32B size)
+{
+
+    U32B pos;
+
+    if (size<4+TRAILLEN ||
+            pread(arcfile,idxtrail,TRAILLEN,(off_t)(size-TRAILLEN))!=TRAILLEN ||
+            memcmp(idxtrail+16,IDXID,4)) return 0;
+    pos=getval(idxtrail,8);
+    return pos<4 || pos>size-TRAILLEN?0:pos;
+}
+
+/*	Load the member table from the index of an archive of size
+	bytes. Returns 0 if there is no valid index.
+*/
+
+static int getindex(U32B size)
+{
+
+    unsigned char *buf,*p,*hdr;
+    U32B pos,len,end,clen,cnt;
+    unsigned hlen,live,i;
+
+    if ((pos=idxpos(size))==0) return 0;
+    cnt=getval(idxtrail+8,4);
+    if ((cnt<COUNTMAX?cnt:COUNTMAX)!=arccnt) return 0;
+    len=size-TRAILLEN-pos;
+    if ((buf=malloc(len+1))==NULL) error(1,ERR_MEM,"getindex()");
+    if (pread(arcfile,buf,len,(off_t)pos)!=len ||
+            crc32upd(0,buf,len)!=getval(idxtrail+12,4))
+    {
+        free(buf);
+        return 0;
+    }
+    for (p=buf,end=4; p<buf+len; p+=8+hlen)
+    {
+        if (buf+len-p<8 || (hlen=hdrlen(p+8,buf+len-p-8))==0 ||
+                getval(p,8)<end) break;
+        clen=getval(p+9,LENBYTES(p[8]));
+        end=getval(p,8)+hlen+clen;
+        if ((hdr=malloc(hlen))==NULL) error(1,ERR_MEM,"getindex()");
+        addmember(getval(p,8),memcpy(hdr,p+8,hlen),hlen,clen);
+    }
+    free(buf);
+    for (live=i=0; i<mcnt; ++i) if (!DEAD(i)) ++live;
+    if (p!=buf+len || end>pos || live!=cnt)
+    {
+        freemembers();
+        return 0;
+    }
+    arccnt=live;
+    arcsize=pos;
+    return 1;
+}
+
+/*	Holes are squeezed out only if they waste a good part of the
+	archive or the data after the first one is cheap to move. Else
+	they are left for later additions.
+*/
+
+static int compactable(void)
+{
+
+    U32B move;
+    unsigned i;
+
+    for (i=0; i<mcnt && !DEAD(i); ++i);
+    for (move=0; i<mcnt; ++i)
+    {
+        if (!DEAD(i)) move+=mtab[i].hlen+mtab[i].clen;
+    }
+    return deadlen*HOLEFRAC>=arcsize || move<=MOVEMAX;
+}
+
+static void compact(void)
+{
+
+    U32B opos,len;
+    unsigned i,j;
+
+    opos=4;
+    for (i=j=0; i<mcnt; ++i)
+    {
+        if (DEAD(i))
         {
-            cpylen=hd->clen+hd->mylen;
-            while (cpylen)
-            {
-                if (lseek(arcfile,ipos,SEEK_SET)<0)
-                    error(1,ERR_SEEK,"arc_clean()");
-                len=read(arcfile,ib,BLOCKLEN>cpylen?(unsigned)cpylen:BLOCKLEN);
-                if (len<=0) error(1,ERR_READ,arcname);
-                cpylen-=len;
-                ipos+=len;
-                if (lseek(arcfile,opos,SEEK_SET)<0)
-                    error(1,ERR_SEEK,"arc_clean()");
-                if (write(arcfile,ib,len)!=len) error(1,ERR_WRITE,arcname);
-                opos+=len;
-            }
+            free(mtab[i].hdr);
+            continue;
         }
+        len=mtab[i].hlen+mtab[i].clen;
+        if (mtab[i].pos!=opos) movedata(mtab[i].pos,opos,len);
+        mtab[j]=mtab[i];
+        mtab[j++].pos=opos;
+        opos+=len;
     }
-    md_truncfile(arcfile,opos);
+    mcnt=j;
+    deadlen=0;
+    rehash();
+    arcsize=opos;
+}
+
+static char *blockname(U32B id)
+{
+
+    static char name[20];
+
+    sprintf(name,"%" FX_32B,id);
+    return name;
+}
+
+static unsigned blocks(void)		/* Live solid blocks		*/
+{
+
+    unsigned i,n;
+
+    for (n=i=0; i<mcnt; ++i) if (!DEAD(i) && TYPE(i)==M_BLOCK) ++n;
+    return n;
+}
+
+/*	Delete the blocks no solid member refers to any more */
+
+static void dropblocks(void)
+{
+
+    unsigned char ref[8];
+    char *used;
+    unsigned i,j;
+
+    if ((used=calloc(mcnt+1,1))==NULL) error(1,ERR_MEM,"dropblocks()");
+    for (i=0; i<mcnt; ++i)
+    {
+        if (DEAD(i) || TYPE(i)!=M_SOLID) continue;
+        if (pread(arcfile,ref,8,(off_t)(mtab[i].pos+mtab[i].hlen))!=8)
+            error(1,ERR_READ,arcname);
+        if ((j=findmember(blockname(getval(ref,8)),""))!=NOMEMBER) used[j]=1;
+    }
+    for (i=0; i<mcnt; ++i)
+    {
+        if (!DEAD(i) && TYPE(i)==M_BLOCK && !used[i]) delmember(i);
+    }
+    free(used);
+    putcount();
 }
 
 void arc_close(void)
@@ -177,7 +599,12 @@ void arc_close(void)
 
     if (arcfile>=0)
     {
-        if (dirty) arc_clean();
+        if ((dirty || changed) && !rdonly)
+        {
+            if (solidgone) dropblocks();
+            if (deadlen && compactable()) compact();
+            if (arccnt) putindex();
+        }
         close(arcfile);
         if (!arccnt)
         {
@@ -189,28 +616,34 @@ void arc_close(void)
 static U32B arc_scan(void)
 {
 
-    U32B pos;
-    unsigned i;
-    Fheader *hd;
+    U32B pos,clen,end;
+    unsigned i,hlen;
+    unsigned char *hdr;
 
+    end=arcsize;
+    if (arccnt==COUNTMAX)		/* Count unknown, scan to index	*/
+    {
+        if ((pos=idxpos(arcsize))!=0) end=pos;
+        arccnt=(unsigned)-1;
+    }
     pos=4;
     for (i=0; i<arccnt; ++i)
     {
-        if (pos>=arcsize)
+        if (pos>=end)
         {
-            error(0,ERR_CORRUPTED);
+            if (arccnt!=(unsigned)-1) error(0,ERR_CORRUPTED);
+            endscan();
             arccnt=i;
             return pos;
         }
-        if (lseek(arcfile,pos,SEEK_SET)<0) error(1,ERR_SEEK,"arc_seek()");
-        hd=getheader();
-        pos+=hd->clen+hd->mylen;
-        if (hd->ver==0xff)
-        {
-            dirty=1;
-            --i;
-        }
+        hdr=readheader(pos,&hlen);
+        clen=getval(hdr+1,LENBYTES(hdr[0]));
+        if (ISDEAD(hdr[0])) --i;
+        else getheader(hdr);
+        addmember(pos,hdr,hlen,clen);
+        pos+=clen+hlen;
     }
+    endscan();
     if (pos!=arcsize) dirty=1;
     return pos;
 }
@@ -220,7 +653,9 @@ void arc_open(char *aname,int mode)
 
     char id[2];
 
-    dirty=0;
+    dirty=changed=solidgone=0;
+    deadlen=nextblock=0;
+    rdonly=mode&ARC_RDO;
     arcname=md_arcname(aname);
     if ((arcfile=open(arcname,(mode&ARC_RDO)?AO_RDOFLAGS:AO_FLAGS))>=0)
     {
@@ -231,8 +666,9 @@ void arc_open(char *aname,int mode)
             error(1,ERR_NOHA,arcname);
         }
         arccnt=(unsigned)getvalue(2);
-        arcsize=arc_scan();
-        if (!quiet) printf("\nArchive : %s (%d files)\n",arcname,arccnt);
+        if (!getindex(arcsize)) arcsize=arc_scan();
+        if (!quiet)
+            printf("\nArchive : %s (%d files)\n",arcname,arccnt-blocks());
     }
     else if ((mode&ARC_NEW) && (arcfile=open(arcname,AC_FLAGS))>=0)
     {
@@ -249,7 +685,7 @@ void arc_open(char *aname,int mode)
 void arc_reset(void)
 {
 
-    nextheader=4;
+    mnext=0;
 }
 
 Fheader *arc_seek(void)
@@ -259,26 +695,38 @@ Fheader *arc_seek(void)
 
     for (;;)
     {
-        if (nextheader>=arcsize) return NULL;
-        if (lseek(arcfile,nextheader,SEEK_SET)<0)
-            error(1,ERR_SEEK,"arc_seek()");
-        hd=getheader();
-        thisheader=nextheader;
-        nextheader+=hd->clen+hd->mylen;
-        if (hd->ver==0xff) dirty=1;
-        else if (match(hd->path,hd->name)) return hd;
+        if (mnext>=mcnt) return NULL;
+        mthis=mnext++;
+        if (DEAD(mthis) || TYPE(mthis)==M_BLOCK) continue;
+        hd=getheader(mtab[mthis].hdr);
+        datapos=mtab[mthis].pos+mtab[mthis].hlen;
+        if (match(hd->path,hd->name)) return hd;
     }
 }
 
+/*	Member with exactly path and name (as in the archive), which
+	arc_delete() and arc_datapos() then refer to.
+*/
+
+Fheader *arc_find(char *path, char *name)
+{
+
+    if ((mthis=findmember(path,name))==NOMEMBER) return NULL;
+    datapos=mtab[mthis].pos+mtab[mthis].hlen;
+    return getheader(mtab[mthis].hdr);
+}
+
+U32B arc_datapos(void)
+{
+
+    return datapos;
+}
+
 void arc_delete(void)
 {
 
-    if (lseek(arcfile,thisheader,SEEK_SET)<0)
-        error(1,ERR_SEEK,"arc_delete()");
-    if (write(arcfile,"\xff",1)!=1) error(1,ERR_WRITE,arcname);
-    if (lseek(arcfile,2,SEEK_SET)<0) error(1,ERR_SEEK,"arc_delete()");
-    putvalue(--arccnt,2);
-    dirty=1;
+    delmember(mthis);
+    putcount();
 }
 
 void arc_newfile(char *mdpath, char *name)
@@ -290,19 +738,26 @@ void arc_newfile(char *mdpath, char *name)
     newhdr.path=md_tohapath(mdpath);
     newhdr.name=name;
     newhdr.mdilen=md_newfile();
-    newhdr.mylen=newhdr.mdilen+20+strlen(newhdr.path)+strlen(newhdr.name);
-    bestpos=trypos=arcsize+newhdr.mylen;
+    newhdr.mylen=newhdr.mdilen+HDRWIDE+3+strlen(newhdr.path)+
+                 strlen(newhdr.name);
+    bestpos=trypos=addpos(arcsize,newhdr.mylen);
     addtries=0;
     dirty|=2;
 }
 
-void arc_accept(int method)
+void arc_accept(int method, U32B clen, U32B crc)
 {
 
     bestpos=trypos;
     newhdr.type=method;
-    trypos+=newhdr.clen=ocnt;
-    newhdr.crc=getcrc();
+    trypos=addpos(trypos,newhdr.clen=clen);
+    newhdr.crc=crc;
+}
+
+void arc_setolen(U32B olen)		/* Once a stream has been read	*/
+{
+
+    newhdr.olen=olen;
 }
 
 void arc_trynext(void)
@@ -315,71 +770,127 @@ void arc_trynext(void)
 static void delold(void)
 {
 
-    U32B pos,oldpos;
     unsigned i;
-    Fheader *hd;
 
-    pos=4;
-    for (i=arccnt; i>0; --i)
+    while ((i=findmember(newhdr.path,newhdr.name))!=NOMEMBER) delmember(i);
+}
+
+/*	Smallest run of holes that takes len bytes exactly or with room
+	left for a filler hole. Sets *end past the run.
+*/
+
+static unsigned findhole(U32B len, unsigned *end)
+{
+
+    U32B size,best=0;
+    unsigned i,j,found=NOMEMBER;
+
+    if (deadlen<len) return NOMEMBER;
+    for (i=0; i<mcnt; i=j)
     {
-        if (pos>=arcsize) break;
-        if (lseek(arcfile,pos,SEEK_SET)<0) error(1,ERR_SEEK,"delold()");
-        hd=getheader();
-        oldpos=pos;
-        pos+=hd->clen+hd->mylen;
-        if (hd->ver==0xff)
-        {
-            dirty=1;
-            ++i;
-        }
-        else
+        for (size=0,j=i; j<mcnt && DEAD(j); ++j)
+            size+=mtab[j].hlen+mtab[j].clen;
+        if (j==i) ++j;
+        else if ((size==len || size>=len+HOLEHDR) &&
+                 (found==NOMEMBER || size<best))
         {
-            if (!strcmp(md_strcase(hd->path),newhdr.path) &&
-                    !strcmp(md_strcase(hd->name),newhdr.name))
-            {
-                if (lseek(arcfile,oldpos,SEEK_SET)<0)
-                    error(1,ERR_SEEK,"delold()");
-                if (write(arcfile,"\xff",1)!=1) error(1,ERR_WRITE,arcname);
-                dirty=1;
-                --arccnt;
-            }
+            found=i;
+            *end=j;
+            if ((best=size)==len) break;
         }
     }
+    return found;
 }
 
-int arc_addfile(void)
+/*	Replace the holes i..end-1 by one slot of len bytes at i and a
+	filler hole for the rest. Returns 1 if members were shifted.
+*/
+
+static int fillhole(unsigned i, unsigned end, U32B len)
 {
 
-    U32B basepos,len;
-    int cplen;
+    unsigned char *hdr;
+    U32B pos,size;
+    unsigned n,k;
 
-    if ((basepos=arcsize+newhdr.mylen)!=bestpos)
+    pos=mtab[i].pos;
+    for (size=0,k=i; k<end; ++k)
     {
-        if (lseek(arcfile,basepos,SEEK_SET)<0)
-            error(1,ERR_SEEK,"arc_addfile()");
-        len=newhdr.clen;
-        while (len)
-        {
-            if (lseek(arcfile,bestpos,SEEK_SET)<0)
-                error(1,ERR_SEEK,"arc_addfile()");
-            cplen=BLOCKLEN>len?(int)len:BLOCKLEN;
-            if (read(arcfile,ib,cplen)!=cplen) error(1,ERR_READ,arcname);
-            len-=cplen;
-            bestpos+=cplen;
-            if (lseek(arcfile,basepos,SEEK_SET)<0)
-                error(1,ERR_SEEK,"arc_addfile()");
-            if (write(arcfile,ib,cplen)!=cplen) error(1,ERR_WRITE,arcname);
-            basepos+=cplen;
-        }
+        size+=mtab[k].hlen+mtab[k].clen;
+        free(mtab[k].hdr);
+    }
+    deadlen-=size;
+    n=size>len?2:1;
+    if (mcnt+n-(end-i)>mmax)
+    {
+        mmax<<=1;
+        if ((mtab=realloc(mtab,mmax*sizeof(Member)))==NULL)
+            error(1,ERR_MEM,"fillhole()");
     }
-    if (lseek(arcfile,arcsize,SEEK_SET)<0) error(1,ERR_SEEK,"arc_addfile()");
-    putheader(&newhdr);
+    memmove(mtab+i+n,mtab+end,(mcnt-end)*sizeof(Member));
+    mcnt=mcnt+n-(end-i);
+    if (n==2)
+    {
+        if ((hdr=calloc(HOLEHDR,1))==NULL) error(1,ERR_MEM,"fillhole()");
+        hdr[0]=DEADWIDE;
+        setval(hdr+1,size-len-HOLEHDR,8);
+        if (pwrite(arcfile,hdr,HOLEHDR,(off_t)(pos+len))!=HOLEHDR)
+            error(1,ERR_WRITE,arcname);
+        mtab[i+1].pos=pos+len;
+        mtab[i+1].clen=size-len-HOLEHDR;
+        mtab[i+1].hlen=HOLEHDR;
+        mtab[i+1].hdr=hdr;
+        deadlen+=size-len;
+    }
+    return n!=end-i;
+}
+
+/*	Enter the new member, whose data has been written at from. It
+	goes into a hole if one fits, else at the end of the archive.
+*/
+
+static void newmember(U32B from)
+{
+
+    U32B pos,len;
+    unsigned i,end;
+    int shifted=0;
+
     dirty&=1;
     delold();
+    len=addpos(newhdr.mylen,newhdr.clen);
+    if ((i=findhole(len,&end))!=NOMEMBER)
+    {
+        pos=mtab[i].pos;
+        shifted=fillhole(i,end,len);
+    }
+    else
+    {
+        pos=arcsize;
+        arcsize=addpos(arcsize,len);
+    }
+    if (newhdr.clen && from!=pos+newhdr.mylen)
+        movedata(from,pos+newhdr.mylen,newhdr.clen);
+    if (i==NOMEMBER)
+        addmember(pos,putheader(&newhdr,pos),newhdr.mylen,newhdr.clen);
+    else
+    {
+        mtab[i].pos=pos;
+        mtab[i].clen=newhdr.clen;
+        mtab[i].hlen=newhdr.mylen;
+        mtab[i].hdr=putheader(&newhdr,pos);
+        if (shifted || mcnt>hsize) rehash();
+        else hashin(i);
+    }
+    changed=1;
     ++arccnt;
-    arcsize+=newhdr.mylen+newhdr.clen;
-    if (lseek(arcfile,2,SEEK_SET)<0) error(1,ERR_SEEK,"arc_addfile()");
-    putvalue(arccnt,2);
+    putcount();
+}
+
+int arc_addfile(void)
+{
+
+    newmember(bestpos);
     return 1;
 }
 
@@ -389,15 +900,7 @@ int arc_adddir(void)
     newhdr.type=M_DIR;
     newhdr.olen=newhdr.clen=0;
     newhdr.crc=0;
-
-    if (lseek(arcfile,arcsize,SEEK_SET)<0) error(1,ERR_SEEK,"arc_adddir()");
-    putheader(&newhdr);
-    dirty&=1;
-    delold();
-    ++arccnt;
-    arcsize+=newhdr.mylen;
-    if (lseek(arcfile,2,SEEK_SET)<0) error(1,ERR_SEEK,"arc_adddir()");
-    putvalue(arccnt,2);
+    newmember(arcsize);
     return 1;
 }
 
@@ -411,46 +914,103 @@ int arc_addspecial(char *fullname)
     newhdr.type=M_SPECIAL;
     newhdr.olen=newhdr.clen=md_special(fullname, &sdata);
     newhdr.crc=0;
-
-    if (lseek(arcfile,arcsize,SEEK_SET)<0)
-        error(1,ERR_SEEK,"arc_addspecial()");
-    putheader(&newhdr);
     if (newhdr.clen!=0)
     {
-        if (lseek(arcfile,arcsize+newhdr.mylen,SEEK_SET)<0)
-            error(1,ERR_SEEK,"arc_addspecial()");
-        if (write(arcfile,sdata,newhdr.clen)!=newhdr.clen)
+        if (pwrite(arcfile,sdata,newhdr.clen,
+                   (off_t)(arcsize+newhdr.mylen))!=newhdr.clen)
             error(1,ERR_WRITE,arcname);
     }
-    dirty&=1;
-    delold();
-    ++arccnt;
-    arcsize+=newhdr.mylen+newhdr.clen;
-    if (lseek(arcfile,2,SEEK_SET)<0) error(1,ERR_SEEK,"arc_addspecial()");
-    putvalue(arccnt,2);
+    newmember(arcsize+newhdr.mylen);
     return 1;
 }
 
+/*	Start a solid block, which is then packed and added like a file.
+	Returns its id.
+*/
 
+U32B arc_newblock(void)
+{
 
+    static char path[20];
+    U32B id;
+    unsigned i;
 
+    if (!nextblock)
+    {
+        for (nextblock=1,i=0; i<mcnt; ++i)
+        {
+            if (DEAD(i) || TYPE(i)!=M_BLOCK) continue;
+            if ((id=strtoul(hdrpath(&mtab[i]),NULL,16))>=nextblock)
+                nextblock=id+1;
+        }
+    }
+    strcpy(path,blockname(nextblock));
+    newhdr.ver=MYVER;
+    newhdr.olen=0;
+    newhdr.time=md_systime();
+    newhdr.path=path;
+    newhdr.name="";
+    newhdr.mdilen=0;
+    newhdr.mylen=HDRWIDE+3+strlen(path);
+    bestpos=trypos=addpos(arcsize,newhdr.mylen);
+    addtries=0;
+    dirty|=2;
+    return nextblock++;
+}
 
+/*	Add the file started with arc_newfile() as olen bytes from ofs of
+	the output of block id, share being its part of the block size.
+*/
 
+int arc_addsolid(U32B id, U32B ofs, U32B share, U32B olen, U32B crc)
+{
 
+    unsigned char ref[SOLIDREF];
+
+    setval(ref,id,8);
+    setval(ref+8,ofs,8);
+    setval(ref+16,share,8);
+    if (pwrite(arcfile,ref,SOLIDREF,(off_t)(arcsize+newhdr.mylen))!=SOLIDREF)
+        error(1,ERR_WRITE,arcname);
+    newhdr.type=M_SOLID;
+    newhdr.clen=SOLIDREF;
+    newhdr.olen=olen;
+    newhdr.crc=crc;
+    newmember(arcsize+newhdr.mylen);
+    return 1;
+}
 
+/*	Block reference of the current solid member, 0 if unreadable */
 
+int arc_solidref(U32B *id, U32B *ofs, U32B *share)
+{
 
+    unsigned char ref[SOLIDREF];
 
+    if (mtab[mthis].clen!=SOLIDREF ||
+            pread(arcfile,ref,SOLIDREF,(off_t)datapos)!=SOLIDREF) return 0;
+    *id=getval(ref,8);
+    *ofs=getval(ref+8,8);
+    *share=getval(ref+16,8);
+    return 1;
+}
 
+/*	Data position, original length and CRC of block id, 0 if there
+	is no such block.
+*/
 
+U32B arc_block(U32B id, U32B *olen, U32B *crc)
+{
 
-
-
-
-
-
-
-
-
-
-
+    unsigned char *hdr;
+    unsigned i;
+    int n;
+
+    if ((i=findmember(blockname(id),""))==NOMEMBER || TYPE(i)!=M_BLOCK)
+        return 0;
+    hdr=mtab[i].hdr;
+    n=LENBYTES(hdr[0]);
+    *olen=getval(hdr+1+n,n);
+    *crc=getval(hdr+1+2*n,4);
+    return mtab[i].pos+mtab[i].hlen;
+}
@@ -19,10 +19,14 @@
 	HA archive handling
 *************************************************************************/
 
-#define MYVER	2			/* Version info in archives 	*/
+#define MYVER	4			/* Version info in archives 	*/
 #define LOWVER	2			/* Lowest supported version 	*/
+#define RCVER	3			/* First version with range coder */
+#define WIDEVER	4			/* First version with 8 byte lengths */
 
-enum {M_CPY=0,M_ASC,M_HSC,M_UNK,M_DIR=14,M_SPECIAL};  /* Method types	*/
+enum {M_CPY=0,M_ASC,M_HSC,M_ASCB,M_HSCB,M_ASCW,	/* Method types	*/
+      M_SOLID,M_BLOCK,M_UNK,M_DIR=14,M_SPECIAL
+     };
 
 #define ARC_OLD	0			/* Mode flags for arc_open()	*/
 #define ARC_NEW 1
@@ -57,13 +61,20 @@ extern struct stat arcstat;             /* Archive status (when opened) */
 void arc_open(char *arcname, int mode);
 void arc_reset(void);
 Fheader *arc_seek(void);
+Fheader *arc_find(char *path, char *name);
+U32B arc_datapos(void);
 void arc_delete(void);
 void arc_newfile(char *mdpath, char *name);
 int arc_adddir(void);
 int arc_addspecial(char *fullname);
-void arc_accept(int method);
+void arc_accept(int method, U32B clen, U32B crc);
+void arc_setolen(U32B olen);
 void arc_trynext(void);
 int arc_addfile(void);
+U32B arc_newblock(void);
+int arc_addsolid(U32B id, U32B ofs, U32B share, U32B olen, U32B crc);
+int arc_solidref(U32B *id, U32B *ofs, U32B *share);
+U32B arc_block(U32B id, U32B *olen, U32B *crc);
 
 
 
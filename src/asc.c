@@ -22,8 +22,10 @@
 #include <malloc.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "ha.h"
 #include "haio.h"
+#include "codec.h"
 #include "asc.h"
 #include "swdict.h"
 #include "acoder.h"
@@ -39,6 +41,9 @@
 #define LTCODES (SLCODES+LLCODES)
 #define CTCODES 256
 #define PTCODES 16
+#define PTWCODES 32			/* Position codes for ASW	*/
+#define MINWIN	(256*1024UL)		/* ASW window limits		*/
+#define MAXWIN	(64*1024*1024UL)
 #define LTSTEP 8
 #define MAXLT (750*LTSTEP)
 #define CTSTEP 1
@@ -54,22 +59,60 @@
 #define CPLEN 8
 #define LPLEN 4
 #define MINLENLIM 4096
+#define OPTWIN	2048			/* Positions per optimal parse	*/
+#define OPTNICE	128			/* Match taken without parsing	*/
+#define OPTINF	0xffffffffUL
 
-static U16B ltab[2*LTCODES];
-static U16B eltab[2*LTCODES];
-static U16B ptab[2*PTCODES];
-static U16B ctab[2*CTCODES];
-static U16B ectab[2*CTCODES];
-static U16B ttab[TTORD][2];
-static U16B ccnt,pmax,npt;
-static U16B ces;
-static U16B les;
-static U16B ttcon;
-
-void asc_cleanup(void)
+struct ascstate				/* ASC model			*/
+{
+    U16B ltab[2*LTCODES];
+    U16B eltab[2*LTCODES];
+    U16B ptab[2*PTWCODES];
+    U16B ctab[2*CTCODES];
+    U16B ectab[2*CTCODES];
+    U16B ttab[TTORD][2];
+    U32B ccnt,pmax,window;
+    U16B npt,ptcodes;
+    U16B ces;
+    U16B les;
+    U16B ttcon;
+};
+
+struct ascopt				/* Optimal parse window		*/
+{
+    S16B chr[OPTWIN];
+    U16B mlen[OPTWIN];
+    U32B mpos[OPTWIN];
+    U32B price[OPTWIN+1];
+    U16B back[OPTWIN+1],next[OPTWIN+1];
+    U32B dist[OPTWIN+1];
+    unsigned char con[OPTWIN+1];
+    U32B cprice[CTCODES],lprice[LENCODES];
+};
+
+void asc_optimal(Codec *cx, int on)
+{
+
+    cx->optimal=on;
+}
+
+void ascw_window(Codec *cx, U32B size)
+{
+
+    cx->window=size<MINWIN?MINWIN:size>MAXWIN?MAXWIN:size;
+}
+
+void asc_cleanup(Codec *cx)
+{
+
+    swd_cleanup(cx);
+}
+
+void asc_free(Codec *cx)
 {
 
-    swd_cleanup();
+    swd_free(cx);
+    if (cx->asc!=NULL) free(cx->asc),cx->asc=NULL;
 }
 
 static void tabinit(U16B t[], U16B tl, U16B ival)
@@ -116,80 +159,106 @@ static void tzero(U16B t[], U16B tl, U16B p)
     for (i=p+tl,step=t[i]; i; i>>=1) t[i]-=step;
 }
 
-static void model_init(void)
+static void model_init(Codec *cx, U32B window, U16B ptcodes)
 {
 
     register S16B i;
-
-    ces=CTSTEP;
-    les=LTSTEP;
-    ccnt=0;
-    ttcon=0;
-    npt=pmax=1;
-    for (i=0; i<TTORD; ++i) ttab[i][0]=ttab[i][1]=TTSTEP;
-    tabinit(ltab,LTCODES,0);
-    tabinit(eltab,LTCODES,1);
-    tabinit(ctab,CTCODES,0);
-    tabinit(ectab,CTCODES,1);
-    tabinit(ptab,PTCODES,0);
-    tupd(ptab,PTCODES,MAXPT,PTSTEP,0);
+    register struct ascstate *am;
+
+    if (cx->asc==NULL && (cx->asc=malloc(sizeof(*cx->asc)))==NULL)
+        error(1,ERR_MEM,"model_init()");
+    am=cx->asc;
+    memset(am,0,sizeof(*am));
+
+    am->ces=CTSTEP;
+    am->les=LTSTEP;
+    am->window=window;
+    am->ptcodes=ptcodes;
+    am->ccnt=0;
+    am->ttcon=0;
+    am->npt=am->pmax=1;
+    for (i=0; i<TTORD; ++i) am->ttab[i][0]=am->ttab[i][1]=TTSTEP;
+    tabinit(am->ltab,LTCODES,0);
+    tabinit(am->eltab,LTCODES,1);
+    tabinit(am->ctab,CTCODES,0);
+    tabinit(am->ectab,CTCODES,1);
+    tabinit(am->ptab,ptcodes,0);
+    tupd(am->ptab,ptcodes,MAXPT,PTSTEP,0);
 }
 
-static void pack_init(void)
+static void ttscale(struct ascstate *am, U16B con)
 {
 
-    model_init();
-    ac_init_encode();
+    am->ttab[con][0]>>=1;
+    if (am->ttab[con][0]==0) am->ttab[con][0]=1;
+    am->ttab[con][1]>>=1;
+    if (am->ttab[con][1]==0) am->ttab[con][1]=1;
 }
 
-static void unpack_init(void)
+static void outbits(Codec *cx, U32B v, U32B r)	/* Code v of 0..r-1 */
 {
 
-    model_init();
-    ac_init_decode();
+    while (r>0x4000)
+    {
+        ac_out(cx,v&0xff,(v&0xff)+1,0x100);
+        v>>=8;
+        r=(r+0xff)>>8;
+    }
+    ac_out(cx,v,v+1,r);
 }
 
-static void ttscale(U16B con)
+static U32B inbits(Codec *cx, U32B r)
 {
 
-    ttab[con][0]>>=1;
-    if (ttab[con][0]==0) ttab[con][0]=1;
-    ttab[con][1]>>=1;
-    if (ttab[con][1]==0) ttab[con][1]=1;
+    register U16B t;
+    U32B v;
+    int s;
+
+    for (v=s=0; r>0x4000; s+=8)
+    {
+        t=ac_threshold_val(cx,0x100);
+        ac_in(cx,t,t+1,0x100);
+        v|=(U32B)t<<s;
+        r=(r+0xff)>>8;
+    }
+    t=ac_threshold_val(cx,r);
+    ac_in(cx,t,t+1,r);
+    return v|(U32B)t<<s;
 }
 
-static void codepair(S16B l, S16B p)
+static void codepair(Codec *cx, S16B l, U32B p)
 {
 
     register U16B i,j,lt,k,cf,tot;
-
-    i=ttab[ttcon][0]+ttab[ttcon][1];
-    ac_out(ttab[ttcon][0],i,i+1);
-    ttab[ttcon][1]+=TTSTEP;
-    if (i>=MAXTT) ttscale(ttcon);
-    ttcon=((ttcon<<1)|1)&TTOMASK;
-    while (ccnt>pmax)
+    U32B r;
+    register struct ascstate *am=cx->asc;
+
+    i=am->ttab[am->ttcon][0]+am->ttab[am->ttcon][1];
+    ac_out(cx,am->ttab[am->ttcon][0],i,i+1);
+    am->ttab[am->ttcon][1]+=TTSTEP;
+    if (i>=MAXTT) ttscale(am,am->ttcon);
+    am->ttcon=((am->ttcon<<1)|1)&TTOMASK;
+    while (am->ccnt>am->pmax)
     {
-        tupd(ptab,PTCODES,MAXPT,PTSTEP,npt++);
-        pmax<<=1;
+        tupd(am->ptab,am->ptcodes,MAXPT,PTSTEP,am->npt++);
+        am->pmax<<=1;
     }
 
-    for (i=p,j=0; i; ++j,i>>=1);
-    cf=ptab[PTCODES+j];
-    tot=ptab[1];
-    for (lt=0,i=PTCODES+j; i; i>>=1)
+    for (r=p,j=0; r; ++j,r>>=1);
+    cf=am->ptab[am->ptcodes+j];
+    tot=am->ptab[1];
+    for (lt=0,i=am->ptcodes+j; i; i>>=1)
     {
-        if (i&1) lt+=ptab[i-1];
-        ptab[i]+=PTSTEP;
+        if (i&1) lt+=am->ptab[i-1];
+        am->ptab[i]+=PTSTEP;
     }
-    if (ptab[1]>=MAXPT) tscale(ptab,PTCODES);
-    ac_out(lt,lt+cf,tot);
+    if (am->ptab[1]>=MAXPT) tscale(am->ptab,am->ptcodes);
+    ac_out(cx,lt,lt+cf,tot);
     if (p>1)
     {
-        for (i=0x8000U; !(p&i); i>>=1);
-        j=p&~i;
-        if (i!=(pmax>>1)) ac_out(j,j+1,i);
-        else ac_out(j,j+1,ccnt-(pmax>>1));
+        for (r=0x80000000UL; !(p&r); r>>=1);
+        if (r!=(am->pmax>>1)) outbits(cx,p&~r,r);
+        else outbits(cx,p&~r,am->ccnt-(am->pmax>>1));
     }
     i=l-MINLEN;
     if (i==LENCODES-1) i=SLCODES-1,j=0xffff;
@@ -199,156 +268,321 @@ static void codepair(S16B l, S16B p)
         j=(i-SLCODES+1)&LLMASK;
         i=((i-SLCODES+1)>>LLBITS)+SLCODES;
     }
-    if ((cf=ltab[LTCODES+i])==0)
+    if ((cf=am->ltab[LTCODES+i])==0)
     {
-        ac_out(ltab[1],ltab[1]+les,ltab[1]+les);
+        ac_out(cx,am->ltab[1],am->ltab[1]+am->les,am->ltab[1]+am->les);
         for (lt=0,k=LTCODES+i; k; k>>=1)
         {
-            if (k&1) lt+=eltab[k-1];
-            ltab[k]+=LTSTEP;
+            if (k&1) lt+=am->eltab[k-1];
+            am->ltab[k]+=LTSTEP;
         }
-        if (ltab[1]>=MAXLT) tscale(ltab,LTCODES);
-        ac_out(lt,lt+eltab[LTCODES+i],eltab[1]);
-        tzero(eltab,LTCODES,i);
-        if (eltab[1]!=0) les+=LTSTEP;
-        else les=0;
+        if (am->ltab[1]>=MAXLT) tscale(am->ltab,LTCODES);
+        ac_out(cx,lt,lt+am->eltab[LTCODES+i],am->eltab[1]);
+        tzero(am->eltab,LTCODES,i);
+        if (am->eltab[1]!=0) am->les+=LTSTEP;
+        else am->les=0;
         for (k=i<=LPLEN?0:i-LPLEN;
                 k<(i+LPLEN>=LTCODES-1?LTCODES-1:i+LPLEN); ++k)
         {
-            if (eltab[LTCODES+k]) tupd(eltab,LTCODES,MAXLT,1,k);
+            if (am->eltab[LTCODES+k]) tupd(am->eltab,LTCODES,MAXLT,1,k);
         }
     }
     else
     {
-        tot=ltab[1]+les;
+        tot=am->ltab[1]+am->les;
         for (lt=0,k=LTCODES+i; k; k>>=1)
         {
-            if (k&1) lt+=ltab[k-1];
-            ltab[k]+=LTSTEP;
+            if (k&1) lt+=am->ltab[k-1];
+            am->ltab[k]+=LTSTEP;
         }
-        if (ltab[1]>=MAXLT) tscale(ltab,LTCODES);
-        ac_out(lt,lt+cf,tot);
+        if (am->ltab[1]>=MAXLT) tscale(am->ltab,LTCODES);
+        ac_out(cx,lt,lt+cf,tot);
     }
-    if (ltab[LTCODES+i]==LCUTOFF) les-=LTSTEP<les?LTSTEP:les-1;
-    if (j!=0xffff) ac_out(j,j+1,LLLEN);
-    if (ccnt<POSCODES)
+    if (am->ltab[LTCODES+i]==LCUTOFF) am->les-=LTSTEP<am->les?LTSTEP:am->les-1;
+    if (j!=0xffff) ac_out(cx,j,j+1,LLLEN);
+    if (am->ccnt<am->window)
     {
-        ccnt+=l;
-        if (ccnt>POSCODES) ccnt=POSCODES;
+        am->ccnt+=l;
+        if (am->ccnt>am->window) am->ccnt=am->window;
     }
 }
 
 
-static void codechar(S16B c)
+static void codechar(Codec *cx, S16B c)
 {
 
     register U16B i,lt,tot,cf;
-
-    i=ttab[ttcon][0]+ttab[ttcon][1];
-    ac_out(0,ttab[ttcon][0],i+1);
-    ttab[ttcon][0]+=TTSTEP;
-    if (i>=MAXTT) ttscale(ttcon);
-    ttcon=(ttcon<<1)&TTOMASK;
-    if ((cf=ctab[CTCODES+c])==0)
+    register struct ascstate *am=cx->asc;
+
+    i=am->ttab[am->ttcon][0]+am->ttab[am->ttcon][1];
+    ac_out(cx,0,am->ttab[am->ttcon][0],i+1);
+    am->ttab[am->ttcon][0]+=TTSTEP;
+    if (i>=MAXTT) ttscale(am,am->ttcon);
+    am->ttcon=(am->ttcon<<1)&TTOMASK;
+    if ((cf=am->ctab[CTCODES+c])==0)
     {
-        ac_out(ctab[1],ctab[1]+ces,ctab[1]+ces);
+        ac_out(cx,am->ctab[1],am->ctab[1]+am->ces,am->ctab[1]+am->ces);
         for (lt=0,i=CTCODES+c; i; i>>=1)
         {
-            if (i&1) lt+=ectab[i-1];
-            ctab[i]+=CTSTEP;
+            if (i&1) lt+=am->ectab[i-1];
+            am->ctab[i]+=CTSTEP;
         }
-        if (ctab[1]>=MAXCT) tscale(ctab,CTCODES);
-        ac_out(lt,lt+ectab[CTCODES+c],ectab[1]);
-        tzero(ectab,CTCODES,c);
-        if (ectab[1]!=0) ces+=CTSTEP;
-        else ces=0;
+        if (am->ctab[1]>=MAXCT) tscale(am->ctab,CTCODES);
+        ac_out(cx,lt,lt+am->ectab[CTCODES+c],am->ectab[1]);
+        tzero(am->ectab,CTCODES,c);
+        if (am->ectab[1]!=0) am->ces+=CTSTEP;
+        else am->ces=0;
         for (i=c<=CPLEN?0:c-CPLEN;
                 i<(c+CPLEN>=CTCODES-1?CTCODES-1:c+CPLEN); ++i)
         {
-            if (ectab[CTCODES+i]) tupd(ectab,CTCODES,MAXCT,1,i);
+            if (am->ectab[CTCODES+i]) tupd(am->ectab,CTCODES,MAXCT,1,i);
         }
     }
     else
     {
-        tot=ctab[1]+ces;
+        tot=am->ctab[1]+am->ces;
         for (lt=0,i=CTCODES+c; i; i>>=1)
         {
-            if (i&1) lt+=ctab[i-1];
-            ctab[i]+=CTSTEP;
+            if (i&1) lt+=am->ctab[i-1];
+            am->ctab[i]+=CTSTEP;
+        }
+        if (am->ctab[1]>=MAXCT) tscale(am->ctab,CTCODES);
+        ac_out(cx,lt,lt+cf,tot);
+    }
+    if (am->ctab[CTCODES+c]==CCUTOFF) am->ces-=CTSTEP<am->ces?CTSTEP:am->ces-1;
+    if (am->ccnt<am->window) ++am->ccnt;
+}
+
+
+static U32B lg(U32B x)			/* 16*log2(x), approximately	*/
+{
+
+    register U32B n;
+
+    if (x<2) return 0;
+    for (n=0; x>>n>1; ++n);
+    if (n>=4) return (n<<4)+((x>>(n-4))&15);
+    return (n<<4)+((x<<(4-n))&15);
+}
+
+static U32B cost(U32B f, U32B tot)	/* Bits*16 to code f of tot	*/
+{
+
+    return lg(tot)-lg(f?f:1);
+}
+
+static void setprices(struct ascstate *am, struct ascopt *op)
+{
+
+    register U16B i,code;
+
+    for (i=0; i<CTCODES; ++i)
+    {
+        if (am->ctab[CTCODES+i])
+            op->cprice[i]=cost(am->ctab[CTCODES+i],am->ctab[1]+am->ces);
+        else op->cprice[i]=cost(am->ces,am->ctab[1]+am->ces)+
+                               cost(am->ectab[CTCODES+i],am->ectab[1]);
+    }
+    for (i=0; i<LENCODES; ++i)
+    {
+        if (i==LENCODES-1) code=SLCODES-1;
+        else if (i<SLCODES-1) code=i;
+        else code=((i-SLCODES+1)>>LLBITS)+SLCODES;
+        if (am->ltab[LTCODES+code])
+            op->lprice[i]=cost(am->ltab[LTCODES+code],am->ltab[1]+am->les);
+        else op->lprice[i]=cost(am->les,am->ltab[1]+am->les)+
+                               cost(am->eltab[LTCODES+code],am->eltab[1]);
+        if (code>=SLCODES) op->lprice[i]+=LLBITS<<4;
+    }
+}
+
+static U32B posprice(struct ascstate *am, U32B p)
+{
+
+    register U32B i,j;
+
+    for (i=p,j=0; i; ++j,i>>=1);
+    return cost(am->ptab[am->ptcodes+j]?am->ptab[am->ptcodes+j]:PTSTEP,
+                am->ptab[1])+
+           (p>1?(j-1)<<4:0);
+}
+
+static void parse(Codec *cx, struct ascopt *op, U16B n)
+{
+
+    register U16B i,l,len;
+    register struct ascstate *am=cx->asc;
+    U32B p,base;
+    unsigned char c;
+
+    setprices(am,op);
+    op->price[0]=0;
+    op->con[0]=am->ttcon;
+    for (i=1; i<=n; ++i) op->price[i]=OPTINF;
+    for (i=0; i<n; ++i)
+    {
+        c=op->con[i];
+        p=op->price[i]+op->cprice[op->chr[i]]+
+          cost(am->ttab[c][0],am->ttab[c][0]+am->ttab[c][1]+1);
+        if (p<op->price[i+1])
+        {
+            op->price[i+1]=p;
+            op->back[i+1]=0;
+            op->con[i+1]=(c<<1)&TTOMASK;
         }
-        if (ctab[1]>=MAXCT) tscale(ctab,CTCODES);
-        ac_out(lt,lt+cf,tot);
+        if ((len=op->mlen[i])<MINLEN) continue;
+        if (len>n-i) len=n-i;
+        base=op->price[i]+posprice(am,op->mpos[i])+
+             cost(am->ttab[c][1],am->ttab[c][0]+am->ttab[c][1]+1);
+        for (l=MINLEN; l<=len; ++l)
+        {
+            if ((p=base+op->lprice[l-MINLEN])<op->price[i+l])
+            {
+                op->price[i+l]=p;
+                op->back[i+l]=l;
+                op->dist[i+l]=op->mpos[i];
+                op->con[i+l]=((c<<1)|1)&TTOMASK;
+            }
+        }
+    }
+    for (i=n; i; i-=l)
+    {
+        if ((l=op->back[i])==0) l=1;
+        op->next[i-l]=i;
+    }
+    for (i=0; i<n; i=l)
+    {
+        l=op->next[i];
+        if (op->back[l]==0) codechar(cx,op->chr[i]);
+        else codepair(cx,op->back[l],op->dist[l]);
     }
-    if (ctab[CTCODES+c]==CCUTOFF) ces-=CTSTEP<ces?CTSTEP:ces-1;
-    if (ccnt<POSCODES) ++ccnt;
 }
 
+static void pack_optimal(Codec *cx)
+{
+
+    register Swd *sw=cx->swd;
+    register U16B n,l;
+    struct ascopt *op;
 
-void asc_pack(void)
+    if ((op=malloc(sizeof(*op)))==NULL) error(1,ERR_MEM,"pack_optimal()");
+    do
+    {
+        for (n=0; n<OPTWIN; ++n)
+        {
+            sw->mlf=MINLEN-1;
+            swd_findbest(cx);
+            if (sw->chr<0 || sw->mlf>=OPTNICE) break;
+            op->chr[n]=sw->chr;
+            op->mlen[n]=sw->mlf;
+            op->mpos[n]=sw->bpos;
+        }
+        parse(cx,op,n);
+        if (n<OPTWIN && sw->chr>=0)
+        {
+            codepair(cx,sw->mlf,sw->bpos);
+            l=sw->mlf;
+            swd_findbest(cx);		/* swd_accept() skips one more */
+            sw->mlf=l;
+            swd_accept(cx);
+        }
+    }
+    while (sw->chr>=0);
+    free(op);
+}
+
+static int worth(U16B l, U32B p)	/* Short far matches cost too much */
+{
+
+    if (l==MINLEN) return p<MINLENLIM;
+    if (l==MINLEN+1) return p<MINLENLIM*16;	/* Always in ASC	*/
+    if (l==MINLEN+2) return p<MINLENLIM*256;
+    return l>MINLEN;
+}
+
+static void pack_lazy(Codec *cx)
 {
 
     S16B oc;
-    U16B omlf,obpos;
+    U16B omlf;
+    U32B obpos;
+    register Swd *sw=cx->swd;
 
-    swd_init(LENCODES+MINLEN-1,POSCODES);
-    pack_init();
-    for (swd_findbest(); swd_char>=0;)
+    for (swd_findbest(cx); sw->chr>=0;)
     {
-        if (swd_mlf>MINLEN || (swd_mlf==MINLEN && swd_bpos<MINLENLIM))
+        if (sw->mlf>=MINLEN && worth(sw->mlf,sw->bpos))
         {
-            omlf=swd_mlf;
-            obpos=swd_bpos;
-            oc=swd_char;
-            swd_findbest();
-            if (swd_mlf>omlf) codechar(oc);
+            omlf=sw->mlf;
+            obpos=sw->bpos;
+            oc=sw->chr;
+            swd_findbest(cx);
+            if (sw->mlf>omlf) codechar(cx,oc);
             else
             {
-                swd_accept();
-                codepair(omlf,obpos);
-                swd_findbest();
+                swd_accept(cx);
+                codepair(cx,omlf,obpos);
+                swd_findbest(cx);
             }
         }
         else
         {
-            swd_mlf=MINLEN-1;
-            codechar(swd_char);
-            swd_findbest();
+            sw->mlf=MINLEN-1;
+            codechar(cx,sw->chr);
+            swd_findbest(cx);
         }
     }
-    ac_out(ttab[ttcon][0]+ttab[ttcon][1],
-           ttab[ttcon][0]+ttab[ttcon][1]+1,ttab[ttcon][0]+ttab[ttcon][1]+1);
-    ac_end_encode();
-    asc_cleanup();
 }
 
+static void pack(Codec *cx, U32B window, U16B ptcodes)
+{
 
-void asc_unpack(void)
+    register struct ascstate *am;
+
+    swd_init(cx,LENCODES+MINLEN-1,window);
+    model_init(cx,window,ptcodes);
+    ac_init_encode(cx);
+    am=cx->asc;
+    if (cx->optimal) pack_optimal(cx);
+    else pack_lazy(cx);
+    ac_out(cx,am->ttab[am->ttcon][0]+am->ttab[am->ttcon][1],
+           am->ttab[am->ttcon][0]+am->ttab[am->ttcon][1]+1,
+           am->ttab[am->ttcon][0]+am->ttab[am->ttcon][1]+1);
+    ac_end_encode(cx);
+    asc_cleanup(cx);
+}
+
+
+static void unpack(Codec *cx, U32B window, U16B ptcodes)
 {
 
-    register U16B l,p,tv,i,lt;
+    register U16B l,tv,i,lt;
+    register U32B p,r;
+    register struct ascstate *am;
 
-    swd_dinit(POSCODES);
-    unpack_init();
+    swd_dinit(cx,window);
+    model_init(cx,window,ptcodes);
+    ac_init_decode(cx);
+    am=cx->asc;
     for (;;)
     {
-        tv=ac_threshold_val(ttab[ttcon][0]+ttab[ttcon][1]+1);
-        i=ttab[ttcon][0]+ttab[ttcon][1];
-        if (ttab[ttcon][0]>tv)
+        tv=ac_threshold_val(cx,am->ttab[am->ttcon][0]+am->ttab[am->ttcon][1]+1);
+        i=am->ttab[am->ttcon][0]+am->ttab[am->ttcon][1];
+        if (am->ttab[am->ttcon][0]>tv)
         {
-            ac_in(0,ttab[ttcon][0],i+1);
-            ttab[ttcon][0]+=TTSTEP;
-            if (i>=MAXTT) ttscale(ttcon);
-            ttcon=(ttcon<<1)&TTOMASK;
-            tv=ac_threshold_val(ctab[1]+ces);
-            if (tv>=ctab[1])
+            ac_in(cx,0,am->ttab[am->ttcon][0],i+1);
+            am->ttab[am->ttcon][0]+=TTSTEP;
+            if (i>=MAXTT) ttscale(am,am->ttcon);
+            am->ttcon=(am->ttcon<<1)&TTOMASK;
+            tv=ac_threshold_val(cx,am->ctab[1]+am->ces);
+            if (tv>=am->ctab[1])
             {
-                ac_in(ctab[1],ctab[1]+ces,ctab[1]+ces);
-                tv=ac_threshold_val(ectab[1]);
+                ac_in(cx,am->ctab[1],am->ctab[1]+am->ces,am->ctab[1]+am->ces);
+                tv=ac_threshold_val(cx,am->ectab[1]);
                 for (l=2,lt=0;;)
                 {
-                    if (lt+ectab[l]<=tv)
+                    if (lt+am->ectab[l]<=tv)
                     {
-                        lt+=ectab[l];
+                        lt+=am->ectab[l];
                         ++l;
                     }
                     if (l>=CTCODES)
@@ -358,23 +592,23 @@ void asc_unpack(void)
                     }
                     l<<=1;
                 }
-                ac_in(lt,lt+ectab[CTCODES+l],ectab[1]);
-                tzero(ectab,CTCODES,l);
-                if (ectab[1]!=0) ces+=CTSTEP;
-                else ces=0;
+                ac_in(cx,lt,lt+am->ectab[CTCODES+l],am->ectab[1]);
+                tzero(am->ectab,CTCODES,l);
+                if (am->ectab[1]!=0) am->ces+=CTSTEP;
+                else am->ces=0;
                 for (i=l<CPLEN?0:l-CPLEN;
                         i<(l+CPLEN>=CTCODES-1?CTCODES-1:l+CPLEN); ++i)
                 {
-                    if (ectab[CTCODES+i]) tupd(ectab,CTCODES,MAXCT,1,i);
+                    if (am->ectab[CTCODES+i]) tupd(am->ectab,CTCODES,MAXCT,1,i);
                 }
             }
             else
             {
                 for (l=2,lt=0;;)
                 {
-                    if (lt+ctab[l]<=tv)
+                    if (lt+am->ctab[l]<=tv)
                     {
-                        lt+=ctab[l];
+                        lt+=am->ctab[l];
                         l++;
                     }
                     if (l>=CTCODES)
@@ -384,61 +618,60 @@ void asc_unpack(void)
                     }
                     l<<=1;
                 }
-                ac_in(lt,lt+ctab[CTCODES+l],ctab[1]+ces);
+                ac_in(cx,lt,lt+am->ctab[CTCODES+l],am->ctab[1]+am->ces);
             }
-            tupd(ctab,CTCODES,MAXCT,CTSTEP,l);
-            if (ctab[CTCODES+l]==CCUTOFF) ces-=CTSTEP<ces?CTSTEP:ces-1;
-            swd_dchar(l);
-            if (ccnt<POSCODES) ++ccnt;
+            tupd(am->ctab,CTCODES,MAXCT,CTSTEP,l);
+            if (am->ctab[CTCODES+l]==CCUTOFF)
+                am->ces-=CTSTEP<am->ces?CTSTEP:am->ces-1;
+            swd_dchar(cx,l);
+            if (am->ccnt<am->window) ++am->ccnt;
         }
         else if (i>tv)
         {
-            ac_in(ttab[ttcon][0],i,i+1);
-            ttab[ttcon][1]+=TTSTEP;
-            if (i>=MAXTT) ttscale(ttcon);
-            ttcon=((ttcon<<1)|1)&TTOMASK;
-            while (ccnt>pmax)
+            ac_in(cx,am->ttab[am->ttcon][0],i,i+1);
+            am->ttab[am->ttcon][1]+=TTSTEP;
+            if (i>=MAXTT) ttscale(am,am->ttcon);
+            am->ttcon=((am->ttcon<<1)|1)&TTOMASK;
+            while (am->ccnt>am->pmax)
             {
-                tupd(ptab,PTCODES,MAXPT,PTSTEP,npt++);
-                pmax<<=1;
+                tupd(am->ptab,ptcodes,MAXPT,PTSTEP,am->npt++);
+                am->pmax<<=1;
             }
-            tv=ac_threshold_val(ptab[1]);
+            tv=ac_threshold_val(cx,am->ptab[1]);
             for (p=2,lt=0;;)
             {
-                if (lt+ptab[p]<=tv)
+                if (lt+am->ptab[p]<=tv)
                 {
-                    lt+=ptab[p];
+                    lt+=am->ptab[p];
                     p++;
                 }
-                if (p>=PTCODES)
+                if (p>=ptcodes)
                 {
-                    p-=PTCODES;
+                    p-=ptcodes;
                     break;
                 }
                 p<<=1;
             }
-            ac_in(lt,lt+ptab[PTCODES+p],ptab[1]);
-            tupd(ptab,PTCODES,MAXPT,PTSTEP,p);
+            ac_in(cx,lt,lt+am->ptab[ptcodes+p],am->ptab[1]);
+            tupd(am->ptab,ptcodes,MAXPT,PTSTEP,p);
             if (p>1)
             {
-                for (i=1; p; i<<=1,--p);
-                i>>=1;
-                if (i==(pmax>>1)) l=ccnt-(pmax>>1);
-                else l=i;
-                p=ac_threshold_val(l);
-                ac_in(p,p+1,l);
-                p+=i;
+                for (r=1; p; r<<=1,--p);
+                r>>=1;
+                if (r==(am->pmax>>1)) p=inbits(cx,am->ccnt-(am->pmax>>1));
+                else p=inbits(cx,r);
+                p+=r;
             }
-            tv=ac_threshold_val(ltab[1]+les);
-            if (tv>=ltab[1])
+            tv=ac_threshold_val(cx,am->ltab[1]+am->les);
+            if (tv>=am->ltab[1])
             {
-                ac_in(ltab[1],ltab[1]+les,ltab[1]+les);
-                tv=ac_threshold_val(eltab[1]);
+                ac_in(cx,am->ltab[1],am->ltab[1]+am->les,am->ltab[1]+am->les);
+                tv=ac_threshold_val(cx,am->eltab[1]);
                 for (l=2,lt=0;;)
                 {
-                    if (lt+eltab[l]<=tv)
+                    if (lt+am->eltab[l]<=tv)
                     {
-                        lt+=eltab[l];
+                        lt+=am->eltab[l];
                         ++l;
                     }
                     if (l>=LTCODES)
@@ -448,23 +681,23 @@ void asc_unpack(void)
                     }
                     l<<=1;
                 }
-                ac_in(lt,lt+eltab[LTCODES+l],eltab[1]);
-                tzero(eltab,LTCODES,l);
-                if (eltab[1]!=0) les+=LTSTEP;
-                else les=0;
+                ac_in(cx,lt,lt+am->eltab[LTCODES+l],am->eltab[1]);
+                tzero(am->eltab,LTCODES,l);
+                if (am->eltab[1]!=0) am->les+=LTSTEP;
+                else am->les=0;
                 for (i=l<LPLEN?0:l-LPLEN;
                         i<(l+LPLEN>=LTCODES-1?LTCODES-1:l+LPLEN); ++i)
                 {
-                    if (eltab[LTCODES+i]) tupd(eltab,LTCODES,MAXLT,1,i);
+                    if (am->eltab[LTCODES+i]) tupd(am->eltab,LTCODES,MAXLT,1,i);
                 }
             }
             else
             {
                 for (l=2,lt=0;;)
                 {
-                    if (lt+ltab[l]<=tv)
+                    if (lt+am->ltab[l]<=tv)
                     {
-                        lt+=ltab[l];
+                        lt+=am->ltab[l];
                         ++l;
                     }
                     if (l>=LTCODES)
@@ -474,33 +707,76 @@ void asc_unpack(void)
                     }
                     l<<=1;
                 }
-                ac_in(lt,lt+ltab[LTCODES+l],ltab[1]+les);
+                ac_in(cx,lt,lt+am->ltab[LTCODES+l],am->ltab[1]+am->les);
             }
-            tupd(ltab,LTCODES,MAXLT,LTSTEP,l);
-            if (ltab[LTCODES+l]==LCUTOFF) les-=LTSTEP<les?LTSTEP:les-1;
+            tupd(am->ltab,LTCODES,MAXLT,LTSTEP,l);
+            if (am->ltab[LTCODES+l]==LCUTOFF)
+                am->les-=LTSTEP<am->les?LTSTEP:am->les-1;
             if (l==SLCODES-1) l=LENCODES-1;
             else if (l>=SLCODES)
             {
-                i=ac_threshold_val(LLLEN);
-                ac_in(i,i+1,LLLEN);
+                i=ac_threshold_val(cx,LLLEN);
+                ac_in(cx,i,i+1,LLLEN);
                 l=((l-SLCODES)<<LLBITS)+i+SLCODES-1;
             }
             l+=3;
-            if (ccnt<POSCODES)
+            if (am->ccnt<am->window)
             {
-                ccnt+=l;
-                if (ccnt>POSCODES) ccnt=POSCODES;
+                am->ccnt+=l;
+                if (am->ccnt>am->window) am->ccnt=am->window;
             }
-            swd_dpair(l,p);
+            swd_dpair(cx,l,p);
         }
         else
         {
-            ac_in(i,i+1,i+1);
-            flush();
-            asc_cleanup();
+            ac_in(cx,i,i+1,i+1);
+            flush(&cx->io);
+            asc_cleanup(cx);
             return;
         }
     }
 }
 
+void asc_pack(Codec *cx)
+{
+
+    pack(cx,POSCODES,PTCODES);
+}
+
+void asc_unpack(Codec *cx)
+{
+
+    unpack(cx,POSCODES,PTCODES);
+}
 
+/*	The window is written into the stream, so for input of known
+	length it is cut to the next power of two that holds all of it.
+	Small files then do not set up tables for the full window.
+*/
+
+void ascw_pack(Codec *cx)
+{
+
+    U32B win;
+    int i;
+
+    for (win=MINWIN; win<cx->window && win<cx->io.totalsize;) win<<=1;
+    if (win>cx->window) win=cx->window;
+    for (i=0; i<4; ++i) putbyte(&cx->io,(unsigned char)(win>>(i<<3)));
+    pack(cx,win,PTWCODES);
+}
+
+void ascw_unpack(Codec *cx)
+{
+
+    U32B window;
+    int i,c;
+
+    for (window=i=0; i<4; ++i)
+    {
+        if ((c=getbyte(&cx->io))<0) break;
+        window|=(U32B)c<<(i<<3);
+    }
+    if (window<MINWIN || window>MAXWIN) return;	/* CRC will tell */
+    unpack(cx,window,PTWCODES);
+}
@@ -23,18 +23,38 @@
 /*	ASC method packing function
 */
 
-void asc_pack(void);
+void asc_pack(Codec *cx);
 
 
 /*	ASC method unpacking function
 */
 
-void asc_unpack(void);
+void asc_unpack(Codec *cx);
 
-/*	Cleanup for ASC method
+/*	ASW method (ASC with a large window) packing and unpacking
 */
 
-void asc_cleanup(void);
+void ascw_pack(Codec *cx);
+void ascw_unpack(Codec *cx);
+
+#define ASW_WINDOW	(4096*1024UL)	/* Default window		*/
+
+/*	Set ASW window size in bytes for the following runs in cx
+*/
+
+void ascw_window(Codec *cx, U32B size);
+
+/*	Use optimal parsing for the following runs in cx
+*/
+
+void asc_optimal(Codec *cx, int on);
+
+/*	Cleanup for ASC method. The tables are kept for the next run in
+	the same context until asc_free().
+*/
+
+void asc_cleanup(Codec *cx);
+void asc_free(Codec *cx);
 
 
 
@@ -0,0 +1,365 @@
+/***********************************************************************
+  This file is part of HA, a general purpose file archiver.
+  Copyright (C) 1995 Harri Hirvola
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+************************************************************************
+	HA block methods
+***********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "ha.h"
+#include "haio.h"
+#include "codec.h"
+#include "workq.h"
+#include "asc.h"
+#include "hsc.h"
+#include "block.h"
+#include "error.h"
+
+/*	Stream format: for methods with priming the length of the shared
+	prefix (4 bytes, LOHI). Then for each block its original length
+	and packed length (4 bytes each) followed by the packed block. A
+	zero original length ends the stream. The block lengths follow
+	once more as a table, then the number of blocks. HA does not read
+	the table; it is kept for readers that want a block without
+	decoding the ones before it.
+
+	Blocks after the first are packed with a model primed with the
+	first bytes of the first block, which recovers most of what a
+	cold start costs HSC.
+*/
+
+#define MBLOCK		(4UL<<20)	/* Original bytes per block	*/
+#define PRIMELEN	(64UL<<10)	/* Shared prefix for priming	*/
+
+typedef struct
+{
+    void (*pack)(Codec *cx);
+    void (*unpack)(Codec *cx);
+    void (*cleanup)(Codec *cx);
+    void (*prime)(Codec *cx, unsigned char *buf, U32B len);
+} Bmethod;
+
+static Bmethod ascm= {asc_pack,asc_unpack,asc_cleanup,NULL};
+static Bmethod hscm= {hsc_pack,hsc_unpack,hsc_cleanup,hsc_prime};
+
+typedef struct
+{
+    Bmethod *m;
+    Codec *from;			/* Context the block is for	*/
+    int coder;
+    unsigned char *raw,*coded,*prime;
+    U32B rawlen,codedlen,primelen;
+} Block;
+
+typedef struct
+{
+    U32B *len;				/* Original and packed lengths	*/
+    U32B cnt,max;
+} Btable;
+
+static U32B getblock(Haio *io, unsigned char *buf, U32B len)
+{
+
+    U32B got,n;
+
+    for (got=0; got<len; got+=n)
+    {
+        if (io->ibl<=0)
+        {
+            bread(io);
+            if (io->ibl<=0) break;
+        }
+        n=len-got<(U32B)io->ibl?len-got:(U32B)io->ibl;
+        memcpy(buf+got,io->ip+io->ibf,n);
+        io->ibf+=n;
+        io->ibl-=n;
+    }
+    return got;
+}
+
+static void putblock(Haio *io, unsigned char *buf, U32B len)
+{
+
+    U32B n;
+
+    for (; len; buf+=n,len-=n)
+    {
+        n=io->obsize-io->obl<len?io->obsize-io->obl:len;
+        memcpy(io->ob+io->obl,buf,n);
+        if ((io->obl+=n)==io->obsize) bwrite(io);
+    }
+}
+
+static U32B getval(Haio *io)
+{
+
+    U32B val;
+    int i,c;
+
+    for (val=i=0; i<4; ++i)
+    {
+        if ((c=getbyte(io))<0) return 0;
+        val|=(U32B)c<<(i<<3);
+    }
+    return val;
+}
+
+static void putval(Haio *io, U32B val)
+{
+
+    int i;
+
+    for (i=0; i<4; ++i,val>>=8) putbyte(io,(unsigned char)(val&0xff));
+}
+
+static void packblock(Codec *cx, void *arg)
+{
+
+    Block *b=arg;
+
+    codec_settings(cx,b->from);
+    cx->coder=b->coder;
+    if (b->primelen) (*b->m->prime)(cx,b->prime,b->primelen);
+    cx->io.totalsize=b->rawlen;
+    setbufinput(&cx->io,b->raw,b->rawlen,0);
+    setbufoutput(&cx->io,0);
+    (*b->m->pack)(cx);
+    (*b->m->cleanup)(cx);
+    b->coded=cx->io.mbuf;
+    b->codedlen=cx->io.ocnt;
+    cx->io.mbuf=NULL;
+    cx->io.msize=0;
+}
+
+static void unpackblock(Codec *cx, void *arg)
+{
+
+    Block *b=arg;
+
+    codec_settings(cx,b->from);
+    cx->coder=b->coder;
+    if (b->primelen) (*b->m->prime)(cx,b->prime,b->primelen);
+    cx->io.totalsize=b->rawlen;
+    setbufinput(&cx->io,b->coded,b->codedlen,0);
+    setbufoutput(&cx->io,0);
+    (*b->m->unpack)(cx);
+    (*b->m->cleanup)(cx);
+    b->raw=cx->io.mbuf;
+    b->rawlen=cx->io.ocnt;
+    cx->io.mbuf=NULL;
+    cx->io.msize=0;
+}
+
+static void emitcoded(Codec *cx, Block *b, Btable *t)
+{
+
+    if (t->cnt==t->max)
+    {
+        t->max=t->max?2*t->max:64;
+        if ((t->len=realloc(t->len,2*t->max*sizeof(U32B)))==NULL)
+            error(1,ERR_MEM,"emitcoded()");
+    }
+    t->len[2*t->cnt]=b->rawlen;
+    t->len[2*t->cnt++ +1]=b->codedlen;
+    putval(&cx->io,b->rawlen);
+    putval(&cx->io,b->codedlen);
+    putblock(&cx->io,b->coded,b->codedlen);
+    free(b->raw);
+    free(b->coded);
+    free(b);
+}
+
+static void emitraw(Codec *cx, Block *b)
+{
+
+    putblock(&cx->io,b->raw,b->rawlen);
+    free(b->raw);
+    free(b->coded);
+    free(b);
+}
+
+static Block *newblock(Bmethod *m, U32B rawlen, U32B codedlen)
+{
+
+    Block *b;
+
+    if ((b=malloc(sizeof(Block)))==NULL) error(1,ERR_MEM,"newblock()");
+    b->m=m;
+    b->raw=b->coded=b->prime=NULL;
+    b->primelen=0;
+    if ((rawlen && (b->raw=malloc(rawlen))==NULL) ||
+            (codedlen && (b->coded=malloc(codedlen))==NULL))
+        error(1,ERR_MEM,"newblock()");
+    b->rawlen=rawlen;
+    b->codedlen=codedlen;
+    return b;
+}
+
+static void packstream(Codec *cx, Bmethod *m)
+{
+
+    Workq *q=NULL;
+    Codec sub;
+    Block *b;
+    Btable t;
+    unsigned char *prime=NULL;
+    U32B primelen=0,i;
+    int first;
+
+    t.len=NULL;
+    t.cnt=t.max=0;
+    codec_init(&sub);
+    codec_settings(&sub,cx);
+    if (cx->threads>1 && cx->io.totalsize>MBLOCK)
+        q=wq_new(cx->threads,2*cx->threads,packblock);
+    for (first=1;; first=0)
+    {
+        b=newblock(m,MBLOCK,0);
+        b->from=cx;
+        b->coder=cx->coder;
+        if ((b->rawlen=getblock(&cx->io,b->raw,MBLOCK))==0)
+        {
+            free(b->raw);
+            free(b);
+            break;
+        }
+        if (m->prime!=NULL && first)
+        {
+            primelen=b->rawlen<PRIMELEN?b->rawlen:PRIMELEN;
+            if ((prime=malloc(primelen))==NULL) error(1,ERR_MEM,"packstream()");
+            memcpy(prime,b->raw,primelen);
+            putval(&cx->io,primelen);
+        }
+        else
+        {
+            b->prime=prime;
+            b->primelen=primelen;
+        }
+        if (q==NULL)
+        {
+            packblock(&sub,b);
+            emitcoded(cx,b,&t);
+        }
+        else
+        {
+            if (wq_full(q)) emitcoded(cx,wq_next(q),&t);
+            wq_submit(q,b);
+        }
+    }
+    if (q!=NULL)
+    {
+        while ((b=wq_next(q))!=NULL) emitcoded(cx,b,&t);
+        wq_free(q);
+    }
+    if (m->prime!=NULL && first) putval(&cx->io,0);
+    putval(&cx->io,0);
+    for (i=0; i<2*t.cnt; ++i) putval(&cx->io,t.len[i]);
+    putval(&cx->io,t.cnt);
+    flush(&cx->io);
+    if (t.len!=NULL) free(t.len);
+    if (prime!=NULL) free(prime);
+    codec_cleanup(&sub);
+}
+
+static void unpackstream(Codec *cx, Bmethod *m)
+{
+
+    Workq *q=NULL;
+    Codec sub;
+    Block *b;
+    unsigned char *prime=NULL;
+    U32B rawlen,codedlen,primelen=0;
+    int first;
+
+    codec_init(&sub);
+    codec_settings(&sub,cx);
+    if (cx->threads>1 && cx->io.totalsize>MBLOCK)
+        q=wq_new(cx->threads,2*cx->threads,unpackblock);
+    if (m->prime!=NULL) primelen=getval(&cx->io);
+    for (first=1; (rawlen=getval(&cx->io))!=0; first=0)
+    {
+        codedlen=getval(&cx->io);
+        b=newblock(m,0,codedlen);
+        b->from=cx;
+        b->coder=cx->coder;
+        b->rawlen=rawlen;
+        if (getblock(&cx->io,b->coded,codedlen)!=codedlen)
+        {
+            free(b->coded);
+            free(b);
+            break;
+        }
+        if (first && primelen)
+        {
+            unpackblock(&sub,b);
+            if (primelen>b->rawlen) primelen=b->rawlen;
+            if ((prime=malloc(primelen?primelen:1))==NULL)
+                error(1,ERR_MEM,"unpackstream()");
+            memcpy(prime,b->raw,primelen);
+            emitraw(cx,b);
+            continue;
+        }
+        if (!first)
+        {
+            b->prime=prime;
+            b->primelen=primelen;
+        }
+        if (q==NULL)
+        {
+            unpackblock(&sub,b);
+            emitraw(cx,b);
+        }
+        else
+        {
+            if (wq_full(q)) emitraw(cx,wq_next(q));
+            wq_submit(q,b);
+        }
+    }
+    if (q!=NULL)
+    {
+        while ((b=wq_next(q))!=NULL) emitraw(cx,b);
+        wq_free(q);
+    }
+    flush(&cx->io);
+    if (prime!=NULL) free(prime);
+    codec_cleanup(&sub);
+}
+
+void ascb_pack(Codec *cx)
+{
+
+    packstream(cx,&ascm);
+}
+
+void ascb_unpack(Codec *cx)
+{
+
+    unpackstream(cx,&ascm);
+}
+
+void hscb_pack(Codec *cx)
+{
+
+    packstream(cx,&hscm);
+}
+
+void hscb_unpack(Codec *cx)
+{
+
+    unpackstream(cx,&hscm);
+}
@@ -0,0 +1,30 @@
+/***********************************************************************
+  This file is part of HA, a general purpose file archiver.
+  Copyright (C) 1995 Harri Hirvola
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+************************************************************************
+	HA block methods
+***********************************************************************/
+
+/*	Block methods cut the input into blocks which are packed with
+	ASC or HSC independently (on cx->threads threads).
+*/
+
+void ascb_pack(Codec *cx);
+void ascb_unpack(Codec *cx);
+void hscb_pack(Codec *cx);
+void hscb_unpack(Codec *cx);
+
@@ -0,0 +1,63 @@
+/***********************************************************************
+  This file is part of HA, a general purpose file archiver.
+  Copyright (C) 1995 Harri Hirvola
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+************************************************************************
+	HA codec context
+***********************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "ha.h"
+#include "haio.h"
+#include "codec.h"
+#include "swdict.h"
+#include "asc.h"
+#include "hsc.h"
+
+void codec_init(Codec *cx)
+{
+
+    memset(cx,0,sizeof(*cx));
+    cx->io.infile=cx->io.outfile=-1;
+    cx->coder=AC_RANGE;
+    cx->threads=1;
+    cx->effort=SWD_NORMAL;
+    cx->optimal=0;
+    cx->window=ASW_WINDOW;
+}
+
+/*	Contexts made for jobs or blocks pack as the one they work for */
+
+void codec_settings(Codec *cx, Codec *from)
+{
+
+    cx->effort=from->effort;
+    cx->optimal=from->optimal;
+    cx->window=from->window;
+}
+
+void codec_cleanup(Codec *cx)
+{
+
+    asc_free(cx);
+    hsc_free(cx);
+    if (cx->io.mbuf!=NULL) free(cx->io.mbuf),cx->io.mbuf=NULL;
+    cx->io.msize=0;
+    if (cx->io.ib!=NULL) free(cx->io.ib),cx->io.ib=NULL;
+    if (cx->io.ob!=NULL) free(cx->io.ob),cx->io.ob=NULL;
+    cx->io.ibsize=cx->io.obsize=0;
+}
@@ -0,0 +1,58 @@
+/***********************************************************************
+  This file is part of HA, a general purpose file archiver.
+  Copyright (C) 1995 Harri Hirvola
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+************************************************************************
+	HA codec context
+***********************************************************************/
+
+/*	All state of one compression or decompression run lives in a
+	codec context, so independent streams can be processed at the
+	same time (one context per thread). The method specific parts
+	are allocated by the methods themselves, reset in place for the
+	following runs and released by codec_cleanup().
+*/
+
+#define AC_BIT		0		/* Coders (ver 2 and older)	*/
+#define AC_RANGE	1		/* (ver 3 and newer)		*/
+
+typedef struct				/* Arithmetic coder state	*/
+{
+    U16B h,l,v;				/* Bitwise coder		*/
+    S16B s;
+    S16B gpat,ppat;
+    U32B low,range,code;		/* Range coder			*/
+    U32B pending;
+    int cache,carry;
+} Acoder;
+
+typedef struct ha_codec_ctx
+{
+    Haio io;				/* Stream I/O			*/
+    Acoder ac;				/* Arithmetic coder		*/
+    struct swdstate *swd;		/* Sliding window dictionary	*/
+    struct ascstate *asc;		/* ASC model			*/
+    struct hscstate *hsc;		/* HSC model			*/
+    int coder;				/* AC_BIT or AC_RANGE		*/
+    int threads;			/* Threads a method may use	*/
+    int effort;				/* Match finder effort (SWD_*)	*/
+    int optimal;			/* Optimal parsing for ASC	*/
+    U32B window;			/* ASW window			*/
+} Codec;
+
+void codec_init(Codec *cx);
+void codec_settings(Codec *cx, Codec *from);	/* effort, optimal, window */
+void codec_cleanup(Codec *cx);
@@ -22,25 +22,33 @@
 #include <stdio.h>
 #include <malloc.h>
 #include "ha.h"
-#include "cpy.h"
 #include "haio.h"
+#include "codec.h"
+#include "cpy.h"
 
-void cpy(void)
+/*	Blocks are passed from the input buffer (or mapped memory)
+	straight to the output without going through io->ob.
+*/
+
+void cpy(Codec *cx)
 {
 
-    register S16B c;
+    register Haio *io;
     register U32B cnt;
+    int n;
 
-    if ((cnt=totalsize)==0) return;
-    while ((c=getbyte())>=0)
+    io=&cx->io;
+    for (cnt=io->totalsize; cnt; cnt-=n)
     {
-        putbyte(c);
-        if (!--cnt) break;
+        if (io->ibl<=0)
+        {
+            bread(io);
+            if (io->ibl<=0) break;
+        }
+        n=cnt<(U32B)io->ibl?(int)cnt:io->ibl;
+        putbuf(io,io->ip+io->ibf,n);
+        io->ibf+=n;
+        io->ibl-=n;
     }
-    flush();
+    flush(io);
 }
-
-
-
-
-
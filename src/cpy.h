@@ -19,7 +19,7 @@
 	HA CPY method
 ***********************************************************************/
 
-void cpy(void);
+void cpy(Codec *cx);
 
 
 
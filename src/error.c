@@ -22,6 +22,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
 #include "ha.h"
 #include "error.h"
 
@@ -57,14 +59,39 @@ char *error_string[]=
     "Could not read symlink %s",
     "Could not link %s to %s",
     "Could not make fifo %s",
+    "Could not start thread in %s",
+    "%s has lengths too large for this build of HA",
 };
 
 
-void error(int fatal, int number, ...)
+static pthread_key_t trapkey;
+static pthread_once_t trapdone=PTHREAD_ONCE_INIT;
+
+static void maketrapkey(void)
 {
 
-    va_list argptr;
+    pthread_key_create(&trapkey,NULL);
+}
 
+void error_trap(Errtrap *trap)
+{
+
+    pthread_once(&trapdone,maketrapkey);
+    pthread_setspecific(trapkey,trap);
+}
+
+static void report(int fatal, int number, char *msg)
+{
+
+    Errtrap *trap;
+
+    pthread_once(&trapdone,maketrapkey);
+    if (fatal && (trap=pthread_getspecific(trapkey))!=NULL)
+    {
+        trap->number=number;
+        if (msg!=trap->msg) strcpy(trap->msg,msg);
+        longjmp(trap->env,1);
+    }
     fflush(stdout);
     if (inerror)
     {
@@ -75,10 +102,7 @@ void error(int fatal, int number, ...)
         exit(inerror);
     }
     inerror=number;
-    fprintf(stderr,"\n%s: ",myname);
-    va_start(argptr,number);
-    vfprintf(stderr,error_string[number],argptr);
-    fprintf(stderr,"\n");
+    fprintf(stderr,"\n%s: %s\n",myname,msg);
     fflush(stderr);
     if (!fatal)
     {
@@ -90,3 +114,21 @@ void error(int fatal, int number, ...)
     exit(number);
 }
 
+void error(int fatal, int number, ...)
+{
+
+    va_list argptr;
+    char msg[ERRMSGLEN];
+
+    va_start(argptr,number);
+    vsnprintf(msg,sizeof(msg),error_string[number],argptr);
+    va_end(argptr);
+    report(fatal,number,msg);
+}
+
+void error_raise(Errtrap *trap)
+{
+
+    report(1,trap->number,trap->msg);
+}
+
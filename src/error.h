@@ -46,9 +46,29 @@
 #define ERR_RDLINK      25      /* Readlink() error                     */
 #define ERR_MKLINK      26      /* Symlinklink() error                  */
 #define ERR_MKFIFO      27      /* Mkfifo() error                       */
+#define ERR_THREAD      28      /* Could not start thread               */
+#define ERR_TOOBIG      29      /* Value does not fit in U32B           */
+
+#include <setjmp.h>
+
+#define ERRMSGLEN	1024		/* Longest kept error message	*/
+
+/*	A worker thread sets a trap, and a fatal error() in that thread
+	then jumps back to it with the message instead of ending the
+	process. The main thread reports it later with error_raise().
+*/
+
+typedef struct
+{
+    jmp_buf env;
+    int number;				/* 0 if no error		*/
+    char msg[ERRMSGLEN];
+} Errtrap;
 
 extern int inerror;		/* Current error value */
 extern int lasterror;           /* Last error value */
 
 void error(int fatal, int number, ...);
+void error_trap(Errtrap *trap);		/* For calling thread, NULL clears */
+void error_raise(Errtrap *trap);		/* Fatal error with kept message */
 
@@ -23,14 +23,19 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <math.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include "error.h"
 #include "ha.h"
 #include "archive.h"
 #include "haio.h"
+#include "codec.h"
+#include "workq.h"
+#include "swdict.h"
 #include "cpy.h"
 #include "asc.h"
+#include "block.h"
 #include "hsc.h"
 
 /***********************************************************************
@@ -51,10 +56,14 @@ char *myname;
 int quiet=0,useattr=0,special=0;
 static unsigned ilen=0;
 static int fulllist=0,usepath=1,yes=0,touch=0,recurse=0,savedir=0,move=0;
+static int tostdout=0,fromstdin=0;
+static int threads=1;
+static Workq *addq=NULL,*tryq=NULL;
 static char *defpat[]= {ALLFILES};
 static int metqueue[M_UNK+1]= {M_UNK};
 static int (*addthis)(char*, char*);
-static void dummy(void)
+static Codec codec;
+static void dummy(Codec *cx)
 {
     /* Do nothing */
 }
@@ -62,15 +71,18 @@ static void dummy(void)
 struct
 {
     char *name;
-    void (*encode)(void);
-    void (*decode)(void);
-    void (*cleanup)(void);
+    void (*encode)(Codec *cx);
+    void (*decode)(Codec *cx);
+    void (*cleanup)(Codec *cx);
 } method[]=
 {
     {"CPY",cpy,cpy,dummy},
     {"ASC",asc_pack,asc_unpack,asc_cleanup},
     {"HSC",hsc_pack,hsc_unpack,hsc_cleanup},
-    {"3"},{"4"},{"5"},{"6"},{"7"},{"8"},{"9"},{"10"},{"11"},{"12"},{"13"},
+    {"ASB",ascb_pack,ascb_unpack,dummy},
+    {"HSB",hscb_pack,hscb_unpack,dummy},
+    {"ASW",ascw_pack,ascw_unpack,asc_cleanup},
+    {"SOL"},{"BLK"},{"8"},{"9"},{"10"},{"11"},{"12"},{"13"},
     {"DIR"},
     {"SPC"}
 };
@@ -88,7 +100,7 @@ static unsigned getinfo(unsigned char *buf, unsigned blen)
     static unsigned char *idat=infodat;
     unsigned i;
 
-    for (i=0; i<blen && --ilen; i++)
+    for (i=0; i<blen && ilen; i++,ilen--)
     {
         buf[i]=*idat++;
     }
@@ -98,13 +110,14 @@ static unsigned getinfo(unsigned char *buf, unsigned blen)
 static void info(void)
 {
 
-    setoutput(STDOUT_FILENO,0,"stdout");
+    setoutput(&codec.io,STDOUT_FILENO,0,"stdout");
     ilen=infolen;
-    inspecial=getinfo;
-    ibl=0;
+    codec.io.inspecial=getinfo;
+    codec.io.ibl=0;
+    codec.coder=AC_BIT;
     fprintf(stdout,BANNER);
     fflush(stdout);
-    (*method[M_HSC].decode)();
+    (*method[M_HSC].decode)(&codec);
     fflush(stdout);
     exit(lasterror);
 }
@@ -134,12 +147,14 @@ static void makeinfo(char *ifile, char *ofile)
     if ((df=open(ifile,O_RDONLY|O_BINARY))<0 ||
             (arcfile=open(ofile,O_WRONLY|O_BINARY|O_TRUNC|O_CREAT,DEF_FILEATTR))<0)
         exit(99);
-    setinput(df,0,"ifile");
-    outspecial=infoout;
-    obl=0;
+    setinput(&codec.io,df,0,"ifile");
+    setoutput(&codec.io,-1,0,ofile);
+    codec.io.outspecial=infoout;
+    codec.io.obl=0;
+    codec.coder=AC_BIT;
     strcpy(ds,"unsigned char infodat[]={");
     write(arcfile,ds,strlen(ds));
-    (*method[M_HSC].encode)();
+    (*method[M_HSC].encode)(&codec);
     sprintf(ds,"\n};\n\nunsigned infolen=%d;\n",ilen);
     write(arcfile,ds,strlen(ds));
     close(df);
@@ -155,14 +170,17 @@ static void usage(int ex)
             EXAMPLE
             "\n"
             "\n commands :"
-            "\n   a[sdqemr012] - Add files      d[q]         - Delete files"
-            "\n   e[aqty]      - Extract files  f[sdqemr012] - Freshen files"
-            "\n   l[f]         - List files     t[q]         - Test files"
-            "\n   u[sdqemr012] - Update files   x[aqty]      -"
-            " eXtract files with pathnames"
+            "\n   a[sdqemr0-5jcownbgi] - Add files"
+            "\n   f[sdqemr0-5jcownbg]  - Freshen files"
+            "\n   u[sdqemr0-5jcownbg]  - Update files"
+            "\n   e[aqtyjbp]           - Extract files"
+            "\n   x[aqtyjbp]           - eXtract files with pathnames"
+            "\n   t[qejb]              - Test files"
+            "\n   l[f]                 - List files"
+            "\n   d[qeb]               - Delete files"
             "\n"
             "\n switches :"
-            "\n   0,1,2  - try method (0-CPY,1-ASC,2-HSC)"
+            "\n   0-5    - try method (0-CPY,1-ASC,2-HSC,3-ASB,4-HSB,5-ASW)"
             "\n   t      - Touch files          r      - Recurse subdirs"
             "\n   f      - Full listing         y      -"
             " assume Yes on all questions"
@@ -171,6 +189,18 @@ static void usage(int ex)
             "\n   e      - Exclude pathnames    s      - find Special files"
             "\n   q      - Quiet operation      d      -"
             " make Directory entries"
+            "\n   j<n>   - use n threads (after methods, ex. a12j4)"
+            "\n   c<n>   - ASC effort 1-fast,2-normal,3-max,4-tree (after methods)"
+            "\n   o      - Optimal parsing for ASC (slow)"
+            "\n   n      - try all methods also on compressed files"
+            "\n   p      - extract to standard output"
+            "\n   i      - add standard input as the file named (default stdin)"
+            "\n   w<n>   - ASW window n KB, 256-65536 (after methods)"
+            "\n   b<n>   - I/O buffer n KB, 8-65536 (default 1024)"
+            "\n   g<n>   - solid blocks of n MB, 1-1024 (default 16)"
+            "\n"
+            "\n"
+            "\n file - adds standard input as stdin"
             "\n"
             "\nType \"ha h | more\" to get more information about HA."
             "\n"
@@ -222,7 +252,7 @@ static void backstep(int len)
 static void do_list(void)
 {
 
-    U32B tcs,tos;
+    U32B tcs,tos,clen,id,ofs;
     unsigned files;
     Fheader *hd;
 
@@ -246,10 +276,12 @@ static void do_list(void)
             printf("\n-------------------------"
                    "--------------------------------------------------");
         }
+        if (hd->type!=M_SOLID || !arc_solidref(&id,&ofs,&clen))
+            clen=hd->clen;
         printf("\n  %-15s %-11" F_32B " %-11" F_32B " %3d.%d %%   %s  %s",
-               hd->name,hd->olen,hd->clen,
-               (hd->olen==0?100:(int)(100*hd->clen/hd->olen)),
-               (hd->olen==0?0:(int)((1000*hd->clen/hd->olen)%10)),
+               hd->name,hd->olen,clen,
+               (hd->olen==0?100:(int)(100*clen/hd->olen)),
+               (hd->olen==0?0:(int)((1000*clen/hd->olen)%10)),
                md_timestring(hd->time),method[hd->type].name);
         if (fulllist)
         {
@@ -257,7 +289,7 @@ static void do_list(void)
                    *hd->path==0?"(none)":md_tomdpath(hd->path));
             md_listdat();
         }
-        tcs+=hd->clen;
+        tcs+=clen;
         tos+=hd->olen;
         ++files;
         if ((hd=arc_seek())==NULL) break;
@@ -269,17 +301,243 @@ static void do_list(void)
            (tos==0?0:(int)((1000*tcs/tos)%10)));
 }
 
+/***********************************************************************
+  Solid members
+
+  A solid member is a range of the output of a solid block, a hidden
+  member packed as one stream from many small files (switch g). The
+  last block unpacked is kept in memory, so all members of a block
+  are extracted with one run of its method.
+*/
+
+static struct
+{
+    U32B id,len;
+    unsigned char *buf;
+} sblock= {0,0,NULL};
+
+/*	Unpacked data of hd if it is a solid member, else or if its block
+	is damaged NULL (the CRC check then fails).
+*/
+
+static unsigned char *solidslice(Fheader *hd)
+{
+
+    U32B id,ofs,share,pos,olen,crc;
+    void *cumark;
+    int m;
+
+    if (hd->type!=M_SOLID || hd->olen==0 || !arc_solidref(&id,&ofs,&share))
+        return NULL;
+    if (sblock.buf==NULL || sblock.id!=id)
+    {
+        if (sblock.buf!=NULL) free(sblock.buf);
+        sblock.buf=NULL;
+        if ((pos=arc_block(id,&olen,&crc))==0) return NULL;
+        setposinput(&codec.io,arcfile,pos,0,arcname);
+        setbufoutput(&codec.io,CRCCALC);
+        codec.io.totalsize=olen;
+        codec.coder=AC_RANGE;
+        m=getbyte(&codec.io);
+        if (m!=M_ASC && m!=M_HSC && m!=M_ASCW) return NULL;
+        cumark=cu_add(CU_FUNCARG,method[m].cleanup,&codec);
+        (*method[m].decode)(&codec);
+        cu_do(cumark);
+        if (codec.io.ocnt!=olen || getcrc(&codec.io)!=crc) return NULL;
+        sblock.id=id;
+        sblock.len=olen;
+        sblock.buf=codec.io.mbuf;
+        codec.io.mbuf=NULL;
+        codec.io.msize=0;
+    }
+    if (ofs>sblock.len || hd->olen>sblock.len-ofs) return NULL;
+    return sblock.buf+ofs;
+}
+
+/*	Write solid member hd, unpacked at slice, to the output of codec */
+
+static void solidout(Fheader *hd, unsigned char *slice)
+{
+
+    U32B len,n;
+
+    codec.io.totalsize=hd->olen;
+    if (slice==NULL) return;
+    for (len=hd->olen; len; len-=n,slice+=n)
+    {
+        n=len<MEMBLOCK?len:MEMBLOCK;
+        putbuf(&codec.io,slice,(int)n);
+    }
+}
+
+/***********************************************************************
+  Parallel extracting and testing
+
+  With more than one thread, the main thread walks the archive and
+  prepares each file member (prompts, output file) in order, and
+  worker threads decode the members with positional reads from the
+  archive. Files are reported and closed in archive order.
+*/
+
+typedef struct xjob
+{
+    int type,coder,test,of,ok;
+    char *ofname;
+    U32B pos,olen,crc,time;
+    struct xjob *prev,*next;
+} Xjob;
+
+static Workq *xq=NULL;
+static Xjob xpending;			/* Jobs not yet retired		*/
+static void *xmark;
+
+static void unpackjob(Codec *cx, void *arg)
+{
+
+    Xjob *job=arg;
+
+    cx->threads=1;			/* Members are decoded in parallel */
+    codec_settings(cx,&codec);
+    cx->coder=job->coder;
+    setposinput(&cx->io,arcfile,job->pos,0,arcname);
+    setoutput(&cx->io,job->of,CRCCALC,job->ofname);
+    if (job->olen!=0)
+    {
+        cx->io.totalsize=job->olen;
+        (*method[job->type].decode)(cx);
+        (*method[job->type].cleanup)(cx);
+    }
+    job->ok=job->crc==getcrc(&cx->io);
+}
+
+static void xabort(void)
+{
+
+    Xjob *job;
+
+    for (job=xpending.next; job!=NULL; job=job->next)
+    {
+        if (job->test) continue;
+        close(job->of);
+        if (remove(job->ofname)<0) error(0,ERR_REMOVE,job->ofname);
+    }
+}
+
+static void xretire(Xjob *job)
+{
+
+    if (!quiet)
+    {
+        printf("\n%s %s        %s",job->test?"Testing":"Unpacking",
+               method[job->type].name,job->ofname);
+        backstep(strlen(job->ofname)+8);
+        printf("100 %%");
+        fflush(stdout);
+    }
+    if (!job->test)
+    {
+        close(job->of);
+        if (touch) md_setft(job->ofname,md_systime());
+        else md_setft(job->ofname,job->time);
+    }
+    if (!job->ok) error(0,ERR_CRC,NULL);
+    job->prev->next=job->next;
+    if (job->next!=NULL) job->next->prev=job->prev;
+    free(job->ofname);
+    free(job);
+}
+
+static void xqueue(Fheader *hd, int test, int of, char *ofname)
+{
+
+    Xjob *job;
+
+    if ((job=malloc(sizeof(Xjob)))==NULL ||
+            (job->ofname=malloc(strlen(ofname)+1))==NULL)
+        error(1,ERR_MEM,"xqueue()");
+    strcpy(job->ofname,ofname);
+    job->type=hd->type;
+    job->coder=hd->ver<RCVER?AC_BIT:AC_RANGE;
+    job->test=test;
+    job->of=of;
+    job->pos=arc_datapos();
+    job->olen=hd->olen;
+    job->crc=hd->crc;
+    job->time=hd->time;
+    job->ok=0;
+    if ((job->next=xpending.next)!=NULL) job->next->prev=job;
+    job->prev=&xpending;
+    xpending.next=job;
+    while (wq_full(xq)) xretire(wq_next(xq));
+    wq_submit(xq,job);
+}
+
+static void xstart(void)
+{
+
+    if (threads>1)
+    {
+        xq=wq_new(threads,4*threads,unpackjob);
+        xmark=cu_add(CU_FUNC,xabort);
+    }
+}
+
+static void xfinish(void)
+{
+
+    Xjob *job;
+
+    if (xq!=NULL)
+    {
+        while ((job=wq_next(xq))!=NULL) xretire(job);
+        wq_free(xq);
+        xq=NULL;
+        cu_do(xmark);
+    }
+}
+
+/*	Write a file member to standard output (switch p) */
+
+static void pipefile(Fheader *hd)
+{
+
+    unsigned char *slice;
+    void *cumark;
+
+    if (hd->type==M_DIR || hd->type==M_SPECIAL) return;
+    slice=solidslice(hd);
+    setposinput(&codec.io,arcfile,arc_datapos(),0,arcname);
+    setoutput(&codec.io,STDOUT_FILENO,CRCCALC,"stdout");
+    if (hd->type==M_SOLID) solidout(hd,slice);
+    else if (hd->olen!=0)
+    {
+        codec.io.totalsize=hd->olen;
+        codec.coder=hd->ver<RCVER?AC_BIT:AC_RANGE;
+        cumark=cu_add(CU_FUNCARG,method[hd->type].cleanup,&codec);
+        (*method[hd->type].decode)(&codec);
+        cu_do(cumark);
+    }
+    if (hd->crc!=getcrc(&codec.io)) error(0,ERR_CRC,NULL);
+}
+
 static void do_extract(void)
 {
 
     Fheader *hd;
     char *ofname;
-    unsigned char *sdata;
+    unsigned char *sdata,*slice;
     int of,newdir;
     void *cumark;
 
     arc_reset();
     if ((hd=arc_seek())==NULL) error(1,ERR_NOFILES);
+    if (tostdout)
+    {
+        do pipefile(hd);
+        while ((hd=arc_seek())!=NULL);
+        return;
+    }
+    xstart();
     do
     {
         if (usepath)
@@ -305,7 +563,8 @@ static void do_extract(void)
             {
                 if ((sdata=malloc(hd->clen))==NULL)
                     error(1,ERR_MEM,"do_extract()");
-                if (read(arcfile,sdata,hd->clen)!=hd->clen)
+                if (pread(arcfile,sdata,hd->clen,
+                          (off_t)arc_datapos())!=hd->clen)
                     error(1,ERR_READ,arcname);
             }
             else sdata=NULL;
@@ -351,9 +610,16 @@ static void do_extract(void)
                 if ((of=open(ofname,O_WRONLY|O_BINARY|O_CREAT|O_EXCL,
                              DEF_FILEATTR))<0) error(0,ERR_OPEN,ofname);
             }
-            setinput(arcfile,0,arcname);
-            if (quiet) setoutput(of,CRCCALC,ofname);
-            else setoutput(of,CRCCALC|PROGDISP,ofname);
+            if (xq!=NULL && hd->type!=M_SOLID)
+            {
+                if (useattr) md_setfattrs(ofname);
+                xqueue(hd,0,of,ofname);
+                break;
+            }
+            slice=solidslice(hd);
+            setposinput(&codec.io,arcfile,arc_datapos(),0,arcname);
+            if (quiet) setoutput(&codec.io,of,CRCCALC,ofname);
+            else setoutput(&codec.io,of,CRCCALC|PROGDISP,ofname);
             if (!quiet)
             {
                 printf("\nUnpacking %s        %s",
@@ -361,19 +627,21 @@ static void do_extract(void)
                 backstep(strlen(ofname)+8);
             }
             fflush(stdout);
-            if (hd->olen!=0)
+            if (hd->type==M_SOLID) solidout(hd,slice);
+            else if (hd->olen!=0)
             {
-                totalsize=hd->olen;
-                cumark=cu_add(CU_FUNC,method[hd->type].cleanup);
+                codec.io.totalsize=hd->olen;
+                codec.coder=hd->ver<RCVER?AC_BIT:AC_RANGE;
+                cumark=cu_add(CU_FUNCARG,method[hd->type].cleanup,&codec);
                 cu_add(CU_RMFILE|CU_CANRELAX,ofname,of);
-                (*method[hd->type].decode)();
+                (*method[hd->type].decode)(&codec);
                 cu_relax(cumark);
                 cu_do(cumark);
             }
             else if (!quiet) printf("100 %%");
             fflush(stdout);
             close(of);
-            if (hd->crc!=getcrc()) error(0,ERR_CRC,NULL);
+            if (hd->crc!=getcrc(&codec.io)) error(0,ERR_CRC,NULL);
             if (touch) md_setft(ofname,md_systime());
             else md_setft(ofname,hd->time);
             if (useattr) md_setfattrs(ofname);
@@ -381,6 +649,7 @@ static void do_extract(void)
         }
     }
     while ((hd=arc_seek())!=NULL);
+    xfinish();
     if (!quiet) printf("\n");
 }
 
@@ -389,10 +658,12 @@ static void do_test(void)
 
     Fheader *hd;
     char *ofname;
+    unsigned char *slice;
     void *cumark;
 
     arc_reset();
     if ((hd=arc_seek())==NULL) error(1,ERR_NOFILES);
+    xstart();
     do
     {
         ofname=md_tomdpath(fullpath(hd->path,hd->name));
@@ -405,29 +676,38 @@ static void do_test(void)
             if (!quiet) printf("\nTesting SPC DONE   %s",ofname);
             break;
         default:
-            setinput(arcfile,0,arcname);
-            if (quiet) setoutput(-1,CRCCALC,"none ??");
-            else setoutput(-1,CRCCALC|PROGDISP,"none ??");
+            if (xq!=NULL && hd->type!=M_SOLID)
+            {
+                xqueue(hd,1,-1,ofname);
+                break;
+            }
+            slice=solidslice(hd);
+            setposinput(&codec.io,arcfile,arc_datapos(),0,arcname);
+            if (quiet) setoutput(&codec.io,-1,CRCCALC,"none ??");
+            else setoutput(&codec.io,-1,CRCCALC|PROGDISP,"none ??");
             if (!quiet)
             {
                 printf("\nTesting %s        %s",method[hd->type].name,ofname);
                 backstep(strlen(ofname)+8);
                 fflush(stdout);
             }
-            if (hd->olen!=0)
+            if (hd->type==M_SOLID) solidout(hd,slice);
+            else if (hd->olen!=0)
             {
-                totalsize=hd->olen;
-                cumark=cu_add(CU_FUNC,method[hd->type].cleanup);
-                (*method[hd->type].decode)();
+                codec.io.totalsize=hd->olen;
+                codec.coder=hd->ver<RCVER?AC_BIT:AC_RANGE;
+                cumark=cu_add(CU_FUNCARG,method[hd->type].cleanup,&codec);
+                (*method[hd->type].decode)(&codec);
                 cu_do(cumark);
             }
             else if (!quiet) printf("100 %%");
             fflush(stdout);
-            if (hd->crc!=getcrc()) error(0,ERR_CRC,NULL);
+            if (hd->crc!=getcrc(&codec.io)) error(0,ERR_CRC,NULL);
             break;
         }
     }
     while ((hd=arc_seek())!=NULL);
+    xfinish();
     if (!quiet) printf("\n");
 }
 
@@ -519,54 +799,506 @@ static int addspecial(char *path, char *name)
     }
 }
 
-static int addfile(char *path, char *name)
+/***********************************************************************
+  Compressed input
+
+  Files that already look compressed are stored with CPY without
+  trying the other methods. A file looks compressed if the order-0
+  entropy of samples taken over it is high. The limit is lower for
+  files starting with the signature of a compressed format.
+*/
+
+#define SKIPMIN		(64UL<<10)	/* Smaller files are not checked */
+#define SAMPLES		8
+#define SAMPLELEN	(32UL<<10)
+#define ENTANY		7.95		/* Bits per byte to skip	*/
+#define ENTSIG		7.5		/* Same with a signature	*/
+
+static struct
 {
+    int pos,len;
+    char *sig;
+} sigs[]= {
+    {0,3,"\xff\xd8\xff"},		/* JPEG		*/
+    {0,4,"\x89PNG"},			/* PNG		*/
+    {0,4,"GIF8"},			/* GIF		*/
+    {0,4,"PK\3\4"},			/* ZIP		*/
+    {0,2,"\x1f\x8b"},			/* gzip		*/
+    {0,3,"BZh"},			/* bzip2	*/
+    {0,6,"\xfd" "7zXZ\0"},		/* xz		*/
+    {0,6,"7z\xbc\xaf\x27\x1c"},	/* 7-Zip	*/
+    {0,4,"\x28\xb5\x2f\xfd"},		/* zstd		*/
+    {0,4,"Rar!"},			/* RAR		*/
+    {0,4,"OggS"},			/* Ogg		*/
+    {0,4,"fLaC"},			/* FLAC		*/
+    {0,3,"ID3"},			/* MP3		*/
+    {4,4,"ftyp"},			/* MP4, MOV	*/
+    {0,0,NULL}
+};
 
-    char *fullname;
-    int i,best,inf;
-    U32B bestsize;
-    void *cumark;
+static int skipcpd=1;
+static int cpyonly[]= {M_CPY,M_UNK};
+
+static int signature(unsigned char *buf, U32B len)
+{
+
+    int i;
+
+    for (i=0; sigs[i].sig!=NULL; ++i)
+    {
+        if ((U32B)(sigs[i].pos+sigs[i].len)<=len &&
+                !memcmp(buf+sigs[i].pos,sigs[i].sig,sigs[i].len)) return 1;
+    }
+    return 0;
+}
+
+/*	Methods to try on a file of len bytes, read from inf or map */
+
+static int *pickmethods(int inf, unsigned char *map, U32B len)
+{
+
+    U32B cnt[256],pos,n,tot;
+    unsigned char *buf,*p;
+    double bits;
+    int i,sig;
+
+    if (!skipcpd || len<SKIPMIN || metqueue[1]==M_UNK) return metqueue;
+    buf=NULL;
+    if (map==NULL && (buf=malloc(SAMPLELEN))==NULL)
+        error(1,ERR_MEM,"pickmethods()");
+    memset(cnt,0,sizeof(cnt));
+    for (sig=i=0,tot=0; i<SAMPLES; ++i)
+    {
+        pos=len/SAMPLES*i;
+        n=len-pos<SAMPLELEN?len-pos:SAMPLELEN;
+        if (map!=NULL) p=map+pos;
+        else
+        {
+            if ((n=pread(inf,buf,n,(off_t)pos))==(U32B)-1) n=0;
+            p=buf;
+        }
+        if (i==0) sig=signature(p,n);
+        for (tot+=n; n; --n) ++cnt[*p++];
+    }
+    if (buf!=NULL) free(buf);
+    for (bits=0,i=0; i<256; ++i)
+    {
+        if (cnt[i]) bits+=cnt[i]*log((double)tot/cnt[i]);
+    }
+    bits/=log(2.0);
+    if (tot && bits>=(sig?ENTSIG:ENTANY)*tot) return cpyonly;
+    return metqueue;
+}
+
+/***********************************************************************
+  Parallel method trials
+
+  With more than one thread and more than one method to try, a file is
+  read into memory once (or used from its mapping) and every method
+  packs it concurrently from that buffer into a buffer of its own. The
+  method that would have won in serial mode is then written to the
+  archive. The trials wait until the parallel adding workers are idle,
+  and share the j<n> threads among them for block methods, so that no
+  more than j<n> threads pack at a time.
+*/
+
+#define TRYMAXSIZE	(512UL<<20)
+#define MAPMIN		(64UL<<10)	/* Smaller files are read	*/
 
-    bestsize=totalsize=md_curfilesize();
+typedef struct
+{
+    int method;
+    unsigned char *in;
+    U32B inlen;
+    unsigned char *buf;
+    U32B len;
+} Tryjob;
+
+static int trycount(void)
+{
+
+    int i,n;
+
+    for (i=n=0; metqueue[i]!=M_UNK; ++i) if (metqueue[i]!=M_CPY) ++n;
+    return n;
+}
+
+static void tryjob(Codec *cx, void *arg)
+{
+
+    Tryjob *job=arg;
+
+    cx->threads=trycount()<threads?threads/trycount():1;
+    codec_settings(cx,&codec);
+    cx->io.totalsize=job->inlen;
+    setbufoutput(&cx->io,0);
+    cx->io.mlimit=job->inlen;
+    setbufinput(&cx->io,job->in,job->inlen,0);
+    (*method[job->method].encode)(cx);
+    (*method[job->method].cleanup)(cx);
+    job->len=cx->io.ocnt;
+    if (job->len<job->inlen)
+    {
+        job->buf=cx->io.mbuf;
+        cx->io.mbuf=NULL;
+        cx->io.msize=0;
+    }
+}
+
+static int tryfile(int inf, unsigned char *map, char *fullname,
+                   U32B *bestsize)
+{
+
+    Tryjob jobs[M_UNK],*job;
+    unsigned char *in,*bestbuf;
+    U32B crc;
+    int i,best;
+
+    if (!quiet)
+    {
+        printf("\rPacking %s          %s",method[metqueue[0]].name,fullname);
+        backstep(strlen(fullname)+10);
+        fflush(stdout);
+    }
+    if (map!=NULL)
+    {
+        crc=crc32upd(0,map,codec.io.totalsize);
+        in=map;
+    }
+    else
+    {
+        setbufoutput(&codec.io,0);
+        setinput(&codec.io,inf,0,fullname);
+        cpy(&codec);
+        in=codec.io.mbuf;
+        codec.io.totalsize=codec.io.ocnt;	/* File may have changed	*/
+        arc_setolen(codec.io.totalsize);
+        crc=crc32upd(0,in,codec.io.totalsize);
+    }
+    if (addq!=NULL) wq_idle(addq);
+    for (i=0; metqueue[i]!=M_UNK; ++i)
+    {
+        jobs[i].buf=NULL;
+        jobs[i].len=codec.io.totalsize;
+        if (metqueue[i]==M_CPY || in==NULL) continue;	/* Empty now */
+        jobs[i].method=metqueue[i];
+        jobs[i].in=in;
+        jobs[i].inlen=codec.io.totalsize;
+        wq_submit(tryq,&jobs[i]);
+    }
+    while (wq_next(tryq)!=NULL);
     best=M_CPY;
-    arc_newfile(usepath?path:"",name);
-    fullname=md_pconcat(0,path,name);
-    if ((inf=open(fullname,O_RDONLY|O_BINARY))<0)
+    bestbuf=in;
+    *bestsize=codec.io.totalsize;
+    for (i=0;;)
     {
-        error(0,ERR_OPEN,fullname);
-        free(fullname);
+        job=&jobs[i];
+        if (metqueue[i]==M_CPY)
+        {
+            best=M_CPY;
+            bestbuf=in;
+            *bestsize=codec.io.totalsize;
+        }
+        else if (job->len<*bestsize)
+        {
+            best=job->method;
+            bestbuf=job->buf;
+            *bestsize=job->len;
+        }
+        if (metqueue[++i]==M_UNK ||
+                (metqueue[i]==M_CPY && *bestsize!=codec.io.totalsize)) break;
+    }
+    arc_trynext();
+    if (*bestsize && write(arcfile,bestbuf,*bestsize)!=*bestsize)
+        error(1,ERR_WRITE,arcname);
+    arc_accept(best,*bestsize,crc);
+    for (i=0; metqueue[i]!=M_UNK; ++i)
+        if (metqueue[i]!=M_CPY && jobs[i].buf!=NULL) free(jobs[i].buf);
+    free(codec.io.mbuf);
+    codec.io.mbuf=NULL;
+    codec.io.msize=0;
+    return best;
+}
+
+static void setfileinput(int inf, unsigned char *map, char *fullname)
+{
+
+    int mode=quiet?CRCCALC:CRCCALC|PROGDISP;
+
+    if (map!=NULL) setbufinput(&codec.io,map,codec.io.totalsize,mode);
+    else
+    {
+        lseek(inf,0,SEEK_SET);
+        setinput(&codec.io,inf,mode,fullname);
+    }
+}
+
+/***********************************************************************
+  Solid adding
+
+  With switch g, files up to SOLIDFILE bytes are queued instead of
+  packed one by one. Once solidsize bytes are queued (and at the end)
+  the queue is packed as one block with the first ASC/ASW or HSC
+  method given, and every file is added as a solid member pointing
+  into it. ASC is packed as ASW, whose window spans more files.
+*/
+
+#define SOLIDFILE	(1UL<<20)	/* Larger files are packed alone */
+#define SOLIDDEF	16		/* Default block size in MB	*/
+
+typedef struct
+{
+    char *path,*name,*fullname;
+    struct stat st;
+    U32B ofs,len,share,crc;
+    int ok;
+} Solidfile;
+
+static U32B solidsize=0;
+static struct
+{
+    Solidfile *f;
+    unsigned cnt,max,cur;
+    int inf;
+    U32B queued,bytes,crc;
+} sq= {NULL,0,0,0,-1,0,0,0};
+
+static int addfile(char *path, char *name);
+
+static int solidmethod(void)
+{
+
+    int i;
+
+    for (i=0; metqueue[i]!=M_UNK; ++i)
+    {
+        switch (metqueue[i])
+        {
+        case M_ASC:
+        case M_ASCB:
+        case M_ASCW:
+            return M_ASCW;
+        case M_HSC:
+        case M_HSCB:
+            return M_HSC;
+        }
+    }
+    return M_UNK;
+}
+
+static int solidfits(U32B size)
+{
+
+    return solidsize && size && size<=SOLIDFILE && solidmethod()!=M_UNK;
+}
+
+/*	Input of a block: the queued files one after the other */
+
+static unsigned solidread(unsigned char *buf, unsigned blen)
+{
+
+    Solidfile *f;
+    unsigned n;
+    int r;
+
+    for (n=0; n<blen && sq.cur<sq.cnt;)
+    {
+        f=sq.f+sq.cur;
+        if (sq.inf<0)
+        {
+            if ((sq.inf=open(f->fullname,O_RDONLY|O_BINARY))<0)
+            {
+                error(0,ERR_OPEN,f->fullname);
+                ++sq.cur;
+                continue;
+            }
+            f->ofs=sq.bytes;
+            f->len=f->crc=0;
+        }
+        if ((r=read(sq.inf,buf+n,blen-n))<0) error(1,ERR_READ,f->fullname);
+        if (r==0)
+        {
+            close(sq.inf);
+            sq.inf=-1;
+            f->ok=1;
+            ++sq.cur;
+            continue;
+        }
+        f->crc=crc32upd(f->crc,buf+n,r);
+        f->len+=r;
+        sq.bytes+=r;
+        n+=r;
+    }
+    sq.crc=crc32upd(sq.crc,buf,n);
+    return n;
+}
+
+static void solidfree(void)
+{
+
+    unsigned i;
+
+    for (i=0; i<sq.cnt; ++i)
+    {
+        free(sq.f[i].fullname);
+        free(sq.f[i].path);
+    }
+    sq.cnt=0;
+    sq.queued=0;
+}
+
+/*	Pack the queued files as one block */
+
+static int solidflush(void)
+{
+
+    Solidfile *f;
+    U32B id,size,share,done;
+    unsigned i,last;
+    int m;
+    void *cumark;
+
+    if (sq.cnt==0) return 0;
+    if (sq.cnt==1)
+    {
+        f=sq.f;
+        filestat=f->st;
+        size=solidsize;
+        solidsize=0;
+        addfile(f->path,f->name);
+        solidsize=size;
+        solidfree();
+        return 1;
+    }
+    m=solidmethod();
+    if (!quiet)
+    {
+        printf("\nPacking %u files as a solid block",sq.cnt);
+        fflush(stdout);
+    }
+    id=arc_newblock();
+    setoutput(&codec.io,arcfile,0,arcname);
+    setinput(&codec.io,-1,0,"solid");
+    codec.io.inspecial=solidread;
+    codec.io.totalsize=sq.queued;
+    codec.coder=AC_RANGE;
+    sq.cur=0;
+    sq.bytes=sq.crc=0;
+    arc_trynext();
+    putbyte(&codec.io,(unsigned char)m);
+    cumark=cu_add(CU_FUNCARG,method[m].cleanup,&codec);
+    (*method[m].encode)(&codec);
+    cu_do(cumark);
+    for (done=size=last=i=0; i<sq.cnt; ++i)	/* Shares by length */
+    {
+        if (!sq.f[i].ok) continue;
+        size+=sq.f[last=i].len;
+        share=sq.bytes?(U32B)((double)codec.io.ocnt*size/sq.bytes):0;
+        sq.f[i].share=share-done;
+        done=share;
+    }
+    if (!sq.f[last].ok)
+    {
+        solidfree();
         return 0;
     }
-    if (!quiet) printf("\n");
-    setoutput(arcfile,0,arcname);
-    if (quiet) setinput(inf,CRCCALC,fullname);
-    else setinput(inf,CRCCALC|PROGDISP,fullname);
-    if (totalsize)
+    sq.f[last].share+=codec.io.ocnt-done;
+    arc_accept(M_BLOCK,codec.io.ocnt,sq.crc);
+    arc_setolen(sq.bytes);
+    arc_addfile();
+    for (i=0; i<sq.cnt; ++i)
+    {
+        f=sq.f+i;
+        if (!f->ok) continue;
+        filestat=f->st;
+        arc_newfile(usepath?f->path:"",f->name);
+        arc_trynext();
+        arc_addsolid(id,f->ofs,f->share,f->len,f->crc);
+        if (!quiet)
+        {
+            printf("\nPacking SOL          %s",f->fullname);
+            backstep(strlen(f->fullname)+10);
+            printf("%s %3d.%d %%",method[M_SOLID].name,
+                   (f->len==0?100:(int)(f->share*100/f->len)),
+                   (f->len==0?0:(int)((f->share*1000/f->len)%10)));
+            fflush(stdout);
+        }
+        if (move)
+        {
+            if (remove(f->fullname)<0)
+            {
+                error(0,ERR_REMOVE,f->fullname);
+            }
+        }
+    }
+    solidfree();
+    return 1;
+}
+
+static int solidadd(char *path, char *name)
+{
+
+    Solidfile *f;
+
+    if (sq.cnt==sq.max)
+    {
+        sq.max=sq.max?2*sq.max:256;
+        if ((sq.f=realloc(sq.f,sq.max*sizeof(Solidfile)))==NULL)
+            error(1,ERR_MEM,"solidadd()");
+    }
+    f=sq.f+sq.cnt++;
+    if ((f->path=malloc(strlen(path)+1))==NULL)
+        error(1,ERR_MEM,"solidadd()");
+    strcpy(f->path,path);
+    f->fullname=md_pconcat(0,path,name);
+    f->name=f->fullname+strlen(f->fullname)-strlen(name);
+    f->st=filestat;
+    f->ok=0;
+    if ((sq.queued+=md_curfilesize())>=solidsize) solidflush();
+    return 1;
+}
+
+/*	Packs the open file with the methods in queue and returns the best
+*/
+
+static int packfile(int inf, unsigned char *map, char *fullname, int *queue,
+                    U32B *bestsize)
+{
+
+    int i,best;
+    void *cumark;
+
+    best=M_CPY;
+    if (tryq!=NULL && codec.io.totalsize && codec.io.totalsize<=TRYMAXSIZE &&
+            queue==metqueue && trycount()>1)
+        return tryfile(inf,map,fullname,bestsize);
+    setoutput(&codec.io,arcfile,0,arcname);
+    setfileinput(inf,map,fullname);
+    if (codec.io.totalsize)
     {
         for (i=0;;)
         {
             arc_trynext();
-            cumark=cu_add(CU_FUNC,method[metqueue[i]].cleanup);
+            cumark=cu_add(CU_FUNCARG,method[queue[i]].cleanup,&codec);
             if (!quiet)
             {
                 printf("\rPacking %s          %s",
-                       method[metqueue[i]].name,fullname);
+                       method[queue[i]].name,fullname);
                 backstep(strlen(fullname)+10);
                 fflush(stdout);
             }
-            (*method[metqueue[i]].encode)();
+            (*method[queue[i]].encode)(&codec);
             cu_do(cumark);
-            if (ocnt<bestsize || metqueue[i]==M_CPY)
+            if (codec.io.ocnt<*bestsize || queue[i]==M_CPY)
             {
-                arc_accept(best=metqueue[i]);
-                bestsize=ocnt;
+                arc_accept(best=queue[i],codec.io.ocnt,getcrc(&codec.io));
+                *bestsize=codec.io.ocnt;
             }
-            if (metqueue[++i]==M_UNK ||
-                    (metqueue[i]==M_CPY && bestsize!=totalsize)) break;
-            setoutput(arcfile,0,arcname);
-            lseek(inf,0,SEEK_SET);
-            if (quiet) setinput(inf,CRCCALC,fullname);
-            else setinput(inf,CRCCALC|PROGDISP,fullname);
+            if (queue[++i]==M_UNK ||
+                    (queue[i]==M_CPY && *bestsize!=codec.io.totalsize))
+                break;
+            setoutput(&codec.io,arcfile,0,arcname);
+            setfileinput(inf,map,fullname);
         }
     }
     else
@@ -577,14 +1309,56 @@ static int addfile(char *path, char *name)
             backstep(strlen(fullname)+10);
             fflush(stdout);
         }
-        arc_accept(M_CPY);
+        arc_accept(M_CPY,codec.io.ocnt,getcrc(&codec.io));
+    }
+    return best;
+}
+
+static int addfile(char *path, char *name)
+{
+
+    char *fullname;
+    int best,inf,*queue;
+    U32B bestsize,maplen;
+    off_t size;
+    unsigned char *map;
+
+    bestsize=codec.io.totalsize=md_curfilesize();
+    arc_newfile(usepath?path:"",name);
+    fullname=md_pconcat(0,path,name);
+    if ((inf=open(fullname,O_RDONLY|O_BINARY))<0)
+    {
+        error(0,ERR_OPEN,fullname);
+        free(fullname);
+        return 0;
+    }
+    maplen=codec.io.totalsize;
+    map=maplen>=MAPMIN?md_mapfile(inf,maplen):NULL;
+    queue=pickmethods(inf,map,codec.io.totalsize);
+    if (queue==metqueue && solidfits(codec.io.totalsize))
+    {
+        if (map!=NULL) md_unmapfile(map,maplen);
+        close(inf);
+        free(fullname);
+        return solidadd(path,name);
+    }
+    if (!quiet) printf("\n");
+    best=packfile(inf,map,fullname,queue,&bestsize);
+    if (map!=NULL && !md_mapok(map))	/* Shrank while packed, read again */
+    {
+        md_unmapfile(map,maplen);
+        map=NULL;
+        if ((size=lseek(inf,0,SEEK_END))<0) error(1,ERR_READ,fullname);
+        bestsize=codec.io.totalsize=(U32B)size;
+        arc_setolen(codec.io.totalsize);
+        best=packfile(inf,map,fullname,queue,&bestsize);
     }
     if (!quiet)
     {
         backstep(5);
         printf("%s %3d.%d %%",method[best].name,
-               (bestsize==0?100:(int)(bestsize*100/totalsize)),
-               (bestsize==0?0:(int)((bestsize*1000/totalsize)%10)));
+               (bestsize==0?100:(int)(bestsize*100/codec.io.totalsize)),
+               (bestsize==0?0:(int)((bestsize*1000/codec.io.totalsize)%10)));
     }
     fflush(stdout);
     arc_addfile();
@@ -596,6 +1370,7 @@ static int addfile(char *path, char *name)
         }
     }
     free(fullname);
+    if (map!=NULL) md_unmapfile(map,maplen);
     close(inf);
     return 1;
 }
@@ -610,13 +1385,9 @@ static int freshentest(char *path, char *name)
 {
 
     Fheader *hd;
-    char *ptab[1];
 
-    ptab[0]=fullpath(md_tohapath(path),name);
-    patterns=ptab;
-    patcnt=1;
-    arc_reset();
-    if ((hd=arc_seek())==NULL || hd->time>=md_curfiletime()) return 0;
+    if ((hd=arc_find(md_tohapath(path),name))==NULL ||
+            hd->time>=md_curfiletime()) return 0;
     return 1;
 }
 
@@ -624,16 +1395,184 @@ static int updatetest(char *path, char *name)
 {
 
     Fheader *hd;
-    char *ptab[1];
 
-    ptab[0]=fullpath(md_tohapath(path),name);
-    patterns=ptab;
-    patcnt=1;
-    arc_reset();
-    if ((hd=arc_seek())!=NULL && hd->time>=md_curfiletime()) return 0;
+    if ((hd=arc_find(md_tohapath(path),name))!=NULL &&
+            hd->time>=md_curfiletime()) return 0;
+    return 1;
+}
+
+/***********************************************************************
+  Parallel adding
+
+  With more than one thread, files found by addindir() are queued as
+  jobs. Worker threads compress regular files into memory buffers and
+  the main thread commits all entries to the archive in the order they
+  were found. Files larger than PARMAXSIZE are packed by the main
+  thread directly into the archive, as in serial mode. Jobs are
+  retired early once the files queued for the workers add up to
+  PARMAXHELD bytes, since each holds its packed data in memory.
+*/
+
+#define PARMAXSIZE	(64UL<<20)
+#define PARMAXHELD	(512UL<<20)
+
+static U32B addheld;			/* Bytes of queued worker files	*/
+
+typedef struct
+{
+    int type;				/* T_REGULAR, T_DIR or T_SPECIAL */
+    char *path,*name,*fullname;
+    struct stat st;
+    int ok;				/* Packed (or pack in main thread) */
+    U32B held;				/* Counted in addheld		*/
+    int best;
+    U32B crc;
+    unsigned char *buf;
+    U32B len;
+} Addjob;
+
+static void packjob(Codec *cx, void *arg)
+{
+
+    Addjob *job=arg;
+    int i,inf,*queue;
+    U32B bestsize;
+
+    if (job->type!=T_REGULAR || job->st.st_size>PARMAXSIZE ||
+            solidfits(job->st.st_size)) return;
+    if ((inf=open(job->fullname,O_RDONLY|O_BINARY))<0) return;
+    codec_settings(cx,&codec);
+    bestsize=cx->io.totalsize=job->st.st_size;
+    job->best=M_CPY;
+    queue=pickmethods(inf,NULL,bestsize);
+    setbufoutput(&cx->io,0);
+    setinput(&cx->io,inf,CRCCALC,job->fullname);
+    if (cx->io.totalsize)
+    {
+        for (i=0;;)
+        {
+            (*method[queue[i]].encode)(cx);
+            (*method[queue[i]].cleanup)(cx);
+            if (cx->io.ocnt<bestsize || queue[i]==M_CPY)
+            {
+                if (job->buf!=NULL) free(job->buf);
+                job->buf=cx->io.mbuf;
+                job->len=bestsize=cx->io.ocnt;
+                job->crc=getcrc(&cx->io);
+                job->best=queue[i];
+                cx->io.mbuf=NULL;
+                cx->io.msize=0;
+            }
+            if (queue[++i]==M_UNK ||
+                    (queue[i]==M_CPY && bestsize!=cx->io.totalsize)) break;
+            setbufoutput(&cx->io,0);
+            lseek(inf,0,SEEK_SET);
+            setinput(&cx->io,inf,CRCCALC,job->fullname);
+        }
+    }
+    else job->crc=getcrc(&cx->io);
+    close(inf);
+    job->ok=1;
+}
+
+static int storejob(Addjob *job)
+{
+
+    arc_newfile(usepath?job->path:"",job->name);
+    arc_trynext();
+    if (job->len && write(arcfile,job->buf,job->len)!=job->len)
+        error(1,ERR_WRITE,arcname);
+    arc_accept(job->best,job->len,job->crc);
+    if (!quiet)
+    {
+        printf("\nPacking %s          %s",method[job->best].name,
+               job->fullname);
+        backstep(strlen(job->fullname)+10);
+        printf("%s %3d.%d %%",method[job->best].name,
+               (job->len==0?100:(int)(job->len*100/job->st.st_size)),
+               (job->len==0?0:(int)((job->len*1000/job->st.st_size)%10)));
+        fflush(stdout);
+    }
+    arc_addfile();
+    if (move)
+    {
+        if (remove(job->fullname)<0)
+        {
+            error(0,ERR_REMOVE,job->fullname);
+        }
+    }
     return 1;
 }
 
+static int commitjob(Addjob *job)
+{
+
+    int found;
+
+    addheld-=job->held;
+    filestat=job->st;
+    switch (job->type)
+    {
+    case T_DIR:
+        found=adddir(job->path,job->name);
+        break;
+    case T_SPECIAL:
+        found=addspecial(job->path,job->name);
+        break;
+    default:
+        if (job->st.st_size>PARMAXSIZE || solidfits(job->st.st_size))
+            found=addfile(job->path,job->name);
+        else if (job->ok) found=storejob(job);
+        else
+        {
+            error(0,ERR_OPEN,job->fullname);
+            found=0;
+        }
+        break;
+    }
+    if (job->buf!=NULL) free(job->buf);
+    free(job->fullname);
+    free(job->path);
+    free(job);
+    return found;
+}
+
+static int queuejob(int type, char *path, char *name)
+{
+
+    Addjob *job;
+    int found;
+
+    if ((job=malloc(sizeof(Addjob)))==NULL ||
+            (job->path=malloc(strlen(path)+1))==NULL)
+        error(1,ERR_MEM,"queuejob()");
+    strcpy(job->path,path);
+    job->fullname=md_pconcat(0,path,name);
+    job->name=job->fullname+strlen(job->fullname)-strlen(name);
+    job->type=type;
+    job->st=filestat;
+    job->ok=0;
+    job->buf=NULL;
+    job->len=0;
+    job->held=type==T_REGULAR && filestat.st_size<=PARMAXSIZE &&
+              !solidfits(filestat.st_size)?(U32B)filestat.st_size:0;
+    for (found=0; wq_full(addq) || (addheld && addheld+job->held>PARMAXHELD);)
+        found|=commitjob(wq_next(addq));
+    addheld+=job->held;
+    wq_submit(addq,job);
+    return found|1;
+}
+
+static int flushjobs(void)
+{
+
+    Addjob *job;
+    int found;
+
+    for (found=0; (job=wq_next(addq))!=NULL;) found|=commitjob(job);
+    return found;
+}
+
 static int addindir(char *path, char *pattern)
 {
 
@@ -658,7 +1597,10 @@ static int addindir(char *path, char *pattern)
         {
         case T_DIR:
             if (savedir && addthis(path,ent->d_name))
-                found|=adddir(path,ent->d_name);
+            {
+                if (addq!=NULL) found|=queuejob(T_DIR,path,ent->d_name);
+                else found|=adddir(path,ent->d_name);
+            }
             if (!recurse) break;
             newpath=md_pconcat(1,path,ent->d_name);
             found|=addindir(newpath,pattern);
@@ -666,31 +1608,123 @@ static int addindir(char *path, char *pattern)
             break;
         case T_SPECIAL:
             if (!md_namecmp(pattern,ent->d_name) || !special) break;
-            if (addthis(path,ent->d_name)) found|=addspecial(path,ent->d_name);
+            if (!addthis(path,ent->d_name)) break;
+            if (addq!=NULL) found|=queuejob(T_SPECIAL,path,ent->d_name);
+            else found|=addspecial(path,ent->d_name);
             break;
         case T_REGULAR:
             if (!md_namecmp(pattern,ent->d_name)) break;
-            if (addthis(path,ent->d_name)) found|=addfile(path,ent->d_name);
+            if (!addthis(path,ent->d_name)) break;
+            if ((U32B)filestat.st_size!=filestat.st_size)  /* 32 bit U32B */
+            {
+                error(0,ERR_TOOBIG,ent->d_name);
+                break;
+            }
+            if (addq!=NULL) found|=queuejob(T_REGULAR,path,ent->d_name);
+            else found|=addfile(path,ent->d_name);
             break;
         }
     }
     closedir(dir);
+    if (addq!=NULL && move) found|=flushjobs();
+    if (move) found|=solidflush();
     cu_do(cumark);
     return found;
 }
 
+/*	Add standard input as member name (stdin if empty). A pipe can
+	not be read twice, so only the first method is used, and the
+	original length is set after packing. An empty stream is stored
+	with CPY.
+*/
+
+#define STREAMLEN	((U32B)-1)	/* Length of input to end	*/
+
+static int addstdin(char *name)
+{
+
+    char *path;
+    int m;
+    void *cumark;
+
+    if (!*name) name="stdin";
+    path=md_strippath(name);
+    name=md_stripname(name);
+    memset(&filestat,0,sizeof(filestat));
+    filestat.st_mode=S_IFREG|DEF_FILEATTR;
+    filestat.st_mtime=md_systime();
+    filestat.st_uid=getuid();
+    filestat.st_gid=getgid();
+    if (!addthis(path,name)) return 0;
+    arc_newfile(usepath?path:"",name);
+    m=metqueue[0];
+    if (!quiet)
+    {
+        printf("\nPacking %s          %s",method[m].name,name);
+        backstep(strlen(name)+10);
+        fflush(stdout);
+    }
+    setoutput(&codec.io,arcfile,0,arcname);
+    setinput(&codec.io,STDIN_FILENO,CRCCALC,"stdin");
+    codec.io.totalsize=STREAMLEN;
+    arc_trynext();
+    cumark=cu_add(CU_FUNCARG,method[m].cleanup,&codec);
+    (*method[m].encode)(&codec);
+    cu_do(cumark);
+    if (codec.io.icnt==0) arc_accept(m=M_CPY,0,getcrc(&codec.io));
+    else arc_accept(m,codec.io.ocnt,getcrc(&codec.io));
+    arc_setolen(codec.io.icnt);
+    if (!quiet)
+    {
+        printf("%s %3d.%d %%",method[m].name,
+               (codec.io.icnt==0?100:(int)(codec.io.ocnt*100/codec.io.icnt)),
+               (codec.io.icnt==0?0:
+                (int)((codec.io.ocnt*1000/codec.io.icnt)%10)));
+        fflush(stdout);
+    }
+    arc_addfile();
+    return 1;
+}
+
 static void do_add(void)
 {
 
     int i,found;
     char *path,*pattern;
 
-    for (found=i=0; i<patcnt; ++i)
+    if (threads>1) addq=wq_new(threads,4*threads,packjob);
+    if (threads>1 && trycount()>1)
+        tryq=wq_new(threads<trycount()?threads:trycount(),M_UNK,tryjob);
+    found=0;
+    if (fromstdin)
+    {
+        if (patcnt>1) usage(ERR_UNKNOWN);
+        found=addstdin(patterns==defpat?"":patterns[0]);
+    }
+    else for (i=0; i<patcnt; ++i)
     {
+        if (!strcmp(patterns[i],"-"))
+        {
+            if (addq!=NULL) found|=flushjobs();
+            found|=addstdin("");
+            continue;
+        }
         path=md_strippath(patterns[i]);
         pattern=md_stripname(patterns[i]);
         found|=addindir(md_strcase(path),md_strcase(pattern));
     }
+    if (addq!=NULL)
+    {
+        found|=flushjobs();
+        wq_free(addq);
+        addq=NULL;
+    }
+    found|=solidflush();
+    if (tryq!=NULL)
+    {
+        wq_free(tryq);
+        tryq=NULL;
+    }
     if (!quiet)
     {
         if (found) printf("\n");
@@ -703,6 +1737,7 @@ static void switchparse(char *s, char *valid)
 {
 
     int i;
+    U32B val;
 
     while (*s)
     {
@@ -739,9 +1774,48 @@ static void switchparse(char *s, char *valid)
         case 'm':
             move=1;
             break;
+        case 'j':
+            for (threads=0; isdigit(s[1]); ++s) threads=threads*10+s[1]-'0';
+            if (threads<1 || threads>MAXTHREADS) error(1,ERR_INVSW,'j');
+            break;
+        case 'o':
+            asc_optimal(&codec,1);
+            break;
+        case 'n':
+            skipcpd=0;
+            break;
+        case 'p':
+            tostdout=quiet=1;
+            break;
+        case 'i':
+            fromstdin=1;
+            break;
+        case 'w':
+            for (val=0; isdigit(s[1]); ++s) val=val*10+s[1]-'0';
+            if (val<256 || val>65536) error(1,ERR_INVSW,'w');
+            ascw_window(&codec,val*1024);
+            break;
+        case 'b':
+            for (val=0; isdigit(s[1]); ++s) val=val*10+s[1]-'0';
+            if (val<8 || val>65536) error(1,ERR_INVSW,'b');
+            setiosize(val*1024);
+            break;
+        case 'g':
+            for (val=0; isdigit(s[1]); ++s) val=val*10+s[1]-'0';
+            if (val==0) val=SOLIDDEF;
+            if (val>1024) error(1,ERR_INVSW,'g');
+            solidsize=val<<20;
+            break;
+        case 'c':
+            if (s[1]<'0'+SWD_FAST || s[1]>'0'+SWD_TREE) error(1,ERR_INVSW,'c');
+            swd_effort(&codec,*++s-'0');
+            break;
         case '0':
         case '1':
         case '2':
+        case '3':
+        case '4':
+        case '5':
             for (*s-='0',i=0; i<M_UNK; ++i)
             {
                 if (metqueue[i]==*s) break;
@@ -795,7 +1869,7 @@ static void (*parse_cmds(char *cs[]))(void)
     switch(tolower(cs[0][0]))
     {
     case ADD:
-        switchparse(cs[0]+1,"sdqemr012");
+        switchparse(cs[0]+1,"sdqemr012345jcownbgi");
         if (!usepath) savedir=0;
         arc_open(cs[1],ARC_OLD|ARC_NEW);
         addthis=addtest;
@@ -803,7 +1877,7 @@ static void (*parse_cmds(char *cs[]))(void)
         fix_methods();
         break;
     case FRESHEN:
-        switchparse(cs[0]+1,"sdqemr012");
+        switchparse(cs[0]+1,"sdqemr012345jcownbg");
         if (!usepath) savedir=0;
         arc_open(cs[1],ARC_OLD);
         addthis=freshentest;
@@ -812,7 +1886,7 @@ static void (*parse_cmds(char *cs[]))(void)
         sloppymatch=0;
         break;
     case UPDATE:
-        switchparse(cs[0]+1,"sdqemr012");
+        switchparse(cs[0]+1,"sdqemr012345jcownbg");
         if (!usepath) savedir=0;
         arc_open(cs[1],ARC_OLD|ARC_NEW);
         addthis=updatetest;
@@ -823,12 +1897,12 @@ static void (*parse_cmds(char *cs[]))(void)
     case EXTRACT:
         usepath=0;
     case PEXTRACT:
-        switchparse(cs[0]+1,"aqty");
+        switchparse(cs[0]+1,"aqtyjbp");
         arc_open(cs[1],ARC_OLD|ARC_RDO);
         cmd=do_extract;
         break;
     case TEST:
-        switchparse(cs[0]+1,"qe");
+        switchparse(cs[0]+1,"qejb");
         arc_open(cs[1],ARC_OLD|ARC_RDO);
         cmd=do_test;
         break;
@@ -838,7 +1912,7 @@ static void (*parse_cmds(char *cs[]))(void)
         cmd=do_list;
         break;
     case DELETE:
-        switchparse(cs[0]+1,"qe");
+        switchparse(cs[0]+1,"qeb");
         arc_open(cs[1],ARC_OLD);
         cmd=do_delete;
         break;
@@ -858,9 +1932,11 @@ int main(int argc, char *argv[])
 
     myname=argv[0];
     md_init();
+    codec_init(&codec);
     if (argc<2) usage(ERR_UNKNOWN);
     if (argc==4 && strcmp(argv[1],"MAKEINFO")==0) makeinfo(argv[2],argv[3]);
     command=parse_cmds(argv+1);
+    codec.threads=threads;
     testsizes();
     switch (argc)
     {
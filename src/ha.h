@@ -29,6 +29,7 @@
 #define CU_FUNC        0x04
 #define CU_RMFILE      0x08
 #define CU_RMDIR       0x10
+#define CU_FUNCARG     0x20
 
 extern char *myname;			/* Name of this program 	*/
 extern char **patterns;			/* List of file patterns 	*/
@@ -20,27 +20,19 @@
 ***********************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include "ha.h"
 #include "haio.h"
 #include "error.h"
-#include "haio.h"
 
-#define uppdcrc(_crc,_c) _crc=(crctab[((int)(_crc)^(_c))&0xff]^((_crc)>>8))
 #define CRCMASK		0xffffffffUL
 #define CRCP		0xEDB88320UL
 
-int infile,outfile;
-U32B crc;
-U32B crctab[256];
-unsigned char ib[BLOCKLEN],ob[BLOCKLEN];
-int ibl,ibf,obl;
-U32B icnt,ocnt,totalsize;
-unsigned char r_crc,w_crc,r_progdisp,w_progdisp;
-static int write_on,crctabok=0;
-static char *outname=NULL,*inname=NULL;
-
-void (*outspecial)(unsigned char *obuf, unsigned oblen);
-unsigned (*inspecial)(unsigned char *ibuf, unsigned iblen);
+static U32B crctab[8][256];
+static pthread_once_t crconce=PTHREAD_ONCE_INIT;
+static U32B iosize=IOBUFLEN;
 
 static void makecrctab(void)
 {
@@ -56,131 +48,259 @@ static void makecrctab(void)
             if (tv&1) tv=(tv>>1)^CRCP;
             else tv>>=1;
         }
-        crctab[i]=tv;
+        crctab[0][i]=tv;
+    }
+    for (i=0; i<256; i++)
+    {
+        for (j=1; j<8; j++)
+        {
+            crctab[j][i]=crctab[0][crctab[j-1][i]&0xff]^(crctab[j-1][i]>>8);
+        }
     }
 }
 
-void setoutput(int fh, int mode, char *name)
+
+/*	CRC-32 of len bytes at buf continued from crc (0 to start).
+	Eight bytes are folded per step with the tables of crctab
+	(slicing-by-8). The tables are built once by the first caller,
+	whichever thread that is.
+*/
+
+U32B crc32upd(U32B crc, unsigned char *buf, U32B len)
+{
+
+    register U32B c;
+
+    pthread_once(&crconce,makecrctab);
+    c=~crc&CRCMASK;
+    for (; len>=8; len-=8,buf+=8)
+    {
+        c^=(U32B)buf[0]|(U32B)buf[1]<<8|(U32B)buf[2]<<16|(U32B)buf[3]<<24;
+        c=crctab[7][c&0xff]^crctab[6][(c>>8)&0xff]^
+          crctab[5][(c>>16)&0xff]^crctab[4][c>>24]^
+          crctab[3][buf[4]]^crctab[2][buf[5]]^
+          crctab[1][buf[6]]^crctab[0][buf[7]];
+    }
+    for (; len; --len) c=crctab[0][(c^*buf++)&0xff]^(c>>8);
+    return c^CRCMASK;
+}
+
+void setiosize(U32B size)
+{
+
+    iosize=size<BLOCKLEN?BLOCKLEN:size;
+}
+
+U32B getiosize(void)
+{
+
+    return iosize;
+}
+
+static unsigned char *iobuf(unsigned char *buf, int *size, int need)
 {
 
-    outname=name;
-    outspecial=NULL;
-    if (fh>=0) write_on=1;
-    else write_on=0;
-    obl=0;
-    ocnt=0;
-    outfile=fh;
-    w_crc=mode&CRCCALC;
-    if (w_crc)
+    if (*size!=need)
     {
-        if (!crctabok) makecrctab();
-        crc=CRCMASK;
+        if ((buf=realloc(buf,need))==NULL) error(1,ERR_MEM,"iobuf()");
+        *size=need;
     }
-    w_progdisp=mode&PROGDISP;
+    return buf;
 }
 
+void setoutput(Haio *io, int fh, int mode, char *name)
+{
+
+    io->ob=iobuf(io->ob,&io->obsize,fh>=0?(int)iosize:BLOCKLEN);
+    io->outname=name;
+    io->outspecial=NULL;
+    io->mlimit=0;
+    if (fh>=0) io->write_on=1;
+    else io->write_on=0;
+    io->obl=0;
+    io->ocnt=0;
+    io->outfile=fh;
+    io->w_crc=mode&CRCCALC;
+    if (io->w_crc) io->crc=0;
+    io->w_progdisp=mode&PROGDISP;
+}
+
+
+/*	Collect output in io->mbuf (ocnt bytes) instead of a file. The
+	buffer is kept for reuse; a caller taking it over must reset
+	mbuf to NULL and msize to 0. If mlimit is set, output beyond
+	mlimit bytes is not stored and input reads end of file, which
+	ends a trial that can not win early.
+*/
 
-void setinput(int fh, int mode, char *name)
+void setbufoutput(Haio *io, int mode)
 {
 
-    inname=name;
-    inspecial=NULL;
-    ibl=0;
-    icnt=0;
-    infile=fh;
-    r_crc=mode&CRCCALC;
-    if (r_crc)
+    setoutput(io,-1,mode,"memory");
+    io->write_on=2;
+}
+
+static void bufwrite(Haio *io, unsigned char *buf, int len)
+{
+
+    U32B need;
+
+    if ((need=io->ocnt+len)>io->mlimit && io->mlimit) return;
+    if (need>io->msize)
     {
-        if (!crctabok) makecrctab();
-        crc=CRCMASK;
+        if (io->msize==0) io->msize=BLOCKLEN;
+        while (io->msize<need) io->msize<<=1;
+        if ((io->mbuf=realloc(io->mbuf,io->msize))==NULL)
+            error(1,ERR_MEM,"bufwrite()");
     }
-    r_progdisp=mode&PROGDISP;
+    memcpy(io->mbuf+io->ocnt,buf,len);
+}
+
+
+void setinput(Haio *io, int fh, int mode, char *name)
+{
+
+    io->inname=name;
+    io->inspecial=NULL;
+    io->mibuf=NULL;
+    io->posread=0;
+    io->ibl=0;
+    io->icnt=0;
+    io->infile=fh;
+    io->r_crc=mode&CRCCALC;
+    if (io->r_crc) io->crc=0;
+    io->r_progdisp=mode&PROGDISP;
+}
+
+
+/*	Read len bytes from memory at buf instead of a file. Input is
+	taken in place, MEMBLOCK bytes at a time, without copying.
+*/
+
+void setbufinput(Haio *io, unsigned char *buf, U32B len, int mode)
+{
+
+    setinput(io,-1,mode,"memory");
+    io->mibuf=buf;
+    io->milen=len;
 }
 
 
-U32B getcrc(void)
+/*	Read from fh starting at pos with pread(), leaving the file
+	position alone. Several streams can then share one handle.
+*/
+
+void setposinput(Haio *io, int fh, U32B pos, int mode, char *name)
 {
 
-    return crc^CRCMASK;
+    setinput(io,fh,mode,name);
+    io->posread=1;
+    io->ipos=pos;
 }
 
-void clearcrc(void)
+
+U32B getcrc(Haio *io)
 {
 
-    crc=CRCMASK;
+    return io->crc;
 }
 
-void bread(void)
+void clearcrc(Haio *io)
 {
 
-    register S16B i;
-    register unsigned char *ptr;
+    io->crc=0;
+}
 
-    if (inspecial!=NULL)
+void bread(Haio *io)
+{
+
+    if (io->mibuf==NULL) io->ib=iobuf(io->ib,&io->ibsize,(int)iosize);
+    io->ip=io->ib;
+    if (io->inspecial!=NULL)
+    {
+        io->ibl=(*io->inspecial)(io->ib,io->ibsize);
+        io->ibf=0;
+        return;
+    }
+    else if (io->mlimit && io->ocnt>io->mlimit)
     {
-        ibl=(*inspecial)(ib,BLOCKLEN);
-        ibf=0;
+        io->ibl=io->ibf=0;
         return;
     }
+    else if (io->mibuf!=NULL)
+    {
+        io->ibl=io->milen-io->icnt>MEMBLOCK?MEMBLOCK:io->milen-io->icnt;
+        io->ip=io->mibuf+io->icnt;
+        io->ibf=0;
+    }
+    else if (io->posread)
+    {
+        io->ibl=pread(io->infile,io->ib,io->ibsize,
+                      (off_t)(io->ipos+io->icnt));
+        if (io->ibl<0) error(1,ERR_READ,io->inname);
+        io->ibf=0;
+    }
     else
     {
-        ibl=read(infile,ib,BLOCKLEN);
-        if (ibl<0) error(1,ERR_READ,inname);
-        ibf=0;
+        io->ibl=read(io->infile,io->ib,io->ibsize);
+        if (io->ibl<0) error(1,ERR_READ,io->inname);
+        io->ibf=0;
     }
-    if (ibl)
+    if (io->ibl)
     {
-        icnt+=ibl;
-        if (r_progdisp)
+        if ((io->icnt+=io->ibl)<(U32B)io->ibl)	/* Wrapped, 32 bit U32B */
+            error(1,ERR_TOOBIG,io->inname);
+        if (io->r_progdisp)
         {
             printf("%3d %%\b\b\b\b\b",
-                   (int)(icnt*100/(totalsize==0?1:totalsize)));
+                   (int)(io->icnt*100/(io->totalsize==0?1:io->totalsize)));
             fflush(stdout);
         }
-        if (r_crc)
-        {
-            for (i=0,ptr=ib; i<ibl; ++i)
-            {
-                uppdcrc(crc,*(ptr++));
-            }
-        }
+        if (io->r_crc) io->crc=crc32upd(io->crc,io->ip,io->ibl);
     }
 }
 
-void bwrite(void)
+static void outblock(Haio *io, unsigned char *buf, int len)
 {
 
-    register S16B i;
-    register unsigned char *ptr;
-
-    if (obl)
+    if (io->outspecial!=NULL)
     {
-        if (outspecial!=NULL)
-        {
-            (*outspecial)(ob,obl);
-        }
-        else
+        (*io->outspecial)(buf,len);
+    }
+    else
+    {
+        if (io->write_on==2) bufwrite(io,buf,len);
+        else if (io->write_on && write(io->outfile,buf,len)!=len)
+            error(1,ERR_WRITE,io->outname);
+        if ((io->ocnt+=len)<(U32B)len) error(1,ERR_TOOBIG,io->outname);
+        if (io->w_progdisp)
         {
-            if (write_on && write(outfile,ob,obl)!=obl)
-                error(1,ERR_WRITE,outname);
-            ocnt+=obl;
-            if (w_progdisp)
-            {
-                printf("%3d %%\b\b\b\b\b",
-                       (int)(ocnt*100/(totalsize==0?1:totalsize)));
-                fflush(stdout);
-            }
-            if (w_crc)
-            {
-                for (i=0,ptr=ob; i<obl; ++i)
-                {
-                    uppdcrc(crc,*(ptr++));
-                }
-            }
+            printf("%3d %%\b\b\b\b\b",
+                   (int)(io->ocnt*100/(io->totalsize==0?1:io->totalsize)));
+            fflush(stdout);
         }
-        obl=0;
+        if (io->w_crc) io->crc=crc32upd(io->crc,buf,len);
     }
 }
 
+void bwrite(Haio *io)
+{
+
+    if (io->obl)
+    {
+        outblock(io,io->ob,io->obl);
+        io->obl=0;
+    }
+}
 
 
+/*	Output len bytes at buf as putbyte() would, but without copying
+	them through io->ob.
+*/
+
+void putbuf(Haio *io, unsigned char *buf, int len)
+{
+
+    bwrite(io);
+    if (len) outblock(io,buf,len);
+}
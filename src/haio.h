@@ -19,25 +19,52 @@
 	HA I/O routines
 ***********************************************************************/
 
-#define BLOCKLEN 	8192
+#define BLOCKLEN 	8192		/* Buffer of memory streams	*/
+#define IOBUFLEN	(1024*1024UL)	/* Default buffer of files	*/
+#define MEMBLOCK	65536		/* Block of memory input	*/
 
-extern unsigned char ib[],ob[];
-extern int ibl,ibf,obl;
-extern U32B icnt,ocnt,totalsize;
+typedef struct				/* State of one I/O stream	*/
+{
+    int infile,outfile;
+    U32B crc;
+    unsigned char *ib,*ob;		/* Allocated on demand		*/
+    unsigned char *ip;			/* Input block, ib or memory	*/
+    int ibsize,obsize;
+    int ibl,ibf,obl;
+    U32B icnt,ocnt,totalsize;
+    unsigned char r_crc,w_crc,r_progdisp,w_progdisp;
+    int write_on;
+    unsigned char *mbuf;		/* Memory output (write_on==2)	*/
+    U32B msize,mlimit;
+    unsigned char *mibuf;		/* Memory input			*/
+    U32B milen;
+    int posread;			/* Positional input from ipos	*/
+    U32B ipos;
+    char *inname,*outname;
+    void (*outspecial)(unsigned char *obuf, unsigned oblen);
+    unsigned (*inspecial)(unsigned char *ibuf, unsigned iblen);
+} Haio;
 
-#define getbyte() (ibl>0?(--ibl,ib[ibf++]):(bread(),(ibl>0?--ibl,ib[ibf++]:-1)))
-#define putbyte(c) {ob[obl++]=(c);if(obl==BLOCKLEN)bwrite();}
-#define flush() bwrite()
+#define getbyte(io) ((io)->ibl>0?(--(io)->ibl,(io)->ip[(io)->ibf++]):	\
+		     (bread(io),((io)->ibl>0?--(io)->ibl,		\
+				 (io)->ip[(io)->ibf++]:-1)))
+#define putbyte(io,c) {(io)->ob[(io)->obl++]=(c);			\
+		       if((io)->obl==(io)->obsize)bwrite(io);}
+#define flush(io) bwrite(io)
 
 #define CRCCALC		1	/* flag to setinput/setoutput */
 #define PROGDISP	2	/* flog to setinput/setoutput */
 
-extern void (*outspecial)(unsigned char *obuf, unsigned oblen);
-extern unsigned (*inspecial)(unsigned char *ibuf, unsigned iblen);
-
-void setoutput(int fh, int mode, char *name);
-void setinput(int fh, int mode, char *name);
-U32B getcrc(void);
-void clearcrc(void);
-void bread(void);
-void bwrite(void);
+void setiosize(U32B size);	/* Buffer size of following file streams */
+U32B getiosize(void);
+void setoutput(Haio *io, int fh, int mode, char *name);
+void setbufoutput(Haio *io, int mode);
+void setinput(Haio *io, int fh, int mode, char *name);
+void setbufinput(Haio *io, unsigned char *buf, U32B len, int mode);
+void setposinput(Haio *io, int fh, U32B pos, int mode, char *name);
+U32B crc32upd(U32B crc, unsigned char *buf, U32B len);
+U32B getcrc(Haio *io);
+void clearcrc(Haio *io);
+void bread(Haio *io);
+void bwrite(Haio *io);
+void putbuf(Haio *io, unsigned char *buf, int len);
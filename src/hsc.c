@@ -21,9 +21,11 @@
 
 #include <malloc.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
 #include "ha.h"
 #include "haio.h"
+#include "codec.h"
 #include "acoder.h"
 #include "hsc.h"
 #include "error.h"
@@ -44,66 +46,75 @@
 
 typedef unsigned char Context[4];
 
-/* model data */
-static Context curcon;		      /* current context */
-static U16B *ht=NULL;		      /* hash table */
-static U16B *hp=NULL;		      /* hash list pointer array */
-static Context *con=NULL;	      /* context array */
-static unsigned char *cl=NULL;	      /* context length array */
-static unsigned char *cc=NULL;	      /* character counts */
-static U16B *ft=NULL;		      /* total frequency of context */
-static unsigned char *fe=NULL;	      /* frequencys under ESCTH in context */
-static U16B *elp=NULL;		      /* expire list previous pointer array */
-static U16B *eln=NULL;		      /* expire list next pointer array */
-static U16B elf,ell;		      /* first and last of expire list */
-static unsigned char *rfm=NULL;	      /* refresh counter array */
-static U16B *fa=NULL;		      /* frequency array */
-static unsigned char *fc=NULL;	      /* character for frequency array */
-static U16B *nb=NULL;		      /* next pointer for frequency array */
-static U16B fcfbl;		      /* pointer to free frequency blocks */
-static U16B nrel;		      /* context for frequency block release */
-
-/* frequency mask system */
-static unsigned char cmask[256];      /* masked characters */
-static unsigned char cmstack[256];    /* stack of cmask[] entries to clear */
-static S16B cmsp;		      /* pointer to cmstack */
-
-/* escape propability modifying system variables */
-static unsigned char nec;	      /* counter for no escape expected */
-static unsigned char iec[MAXCLEN+1];  /* initial escape counters */
-
-/* update stack variables */
-static U16B usp;		      /* stack pointer */
-static U16B cps[MAXCLEN+1]; 	      /* context pointers */
-static U16B as[MAXCLEN+1];	      /* indexes to frequency array */
-
-/* miscalneous */
-static S16B dropcnt;		      /* counter for context len drop */
-static unsigned char maxclen;	      /* current maximum length for context */
-static U16B hrt[HTLEN];		      /* semi random data for hashing */
-static U16B hs[MAXCLEN+1]; 	      /* hash stack for context search */
-static S16B cslen;		      /* length of context to search */
+struct hscstate				/* HSC model			*/
+{
+    /* model data */
+    Context curcon;			/* current context */
+    U16B *ht;				/* hash table */
+    U16B *hp;				/* hash list pointer array */
+    Context *con;			/* context array */
+    unsigned char *cl;			/* context length array */
+    unsigned char *cc;			/* character counts */
+    U16B *ft;				/* total frequency of context */
+    unsigned char *fe;			/* frequencys under ESCTH in context */
+    U16B *elp;				/* expire list previous pointer array */
+    U16B *eln;				/* expire list next pointer array */
+    U16B elf,ell;			/* first and last of expire list */
+    unsigned char *rfm;			/* refresh counter array */
+    U16B *fa;				/* frequency array */
+    unsigned char *fc;			/* character for frequency array */
+    U16B *nb;				/* next pointer for frequency array */
+    U16B fcfbl;				/* pointer to free frequency blocks */
+    U16B nrel;				/* context for frequency block release */
+
+    /* frequency mask system */
+    unsigned char cmask[256];		/* masked characters */
+    unsigned char cmstack[256];		/* stack of cmask[] entries to clear */
+    S16B cmsp;				/* pointer to cmstack */
+
+    /* escape propability modifying system variables */
+    unsigned char nec;			/* counter for no escape expected */
+    unsigned char iec[MAXCLEN+1];	/* initial escape counters */
+
+    /* update stack variables */
+    U16B usp;				/* stack pointer */
+    U16B cps[MAXCLEN+1];		/* context pointers */
+    U16B as[MAXCLEN+1];			/* indexes to frequency array */
+
+    /* miscalneous */
+    S16B dropcnt;			/* counter for context len drop */
+    unsigned char maxclen;		/* current maximum length for context */
+    U16B *hrt;				/* semi random data for hashing */
+    U16B hs[MAXCLEN+1];			/* hash stack for context search */
+    S16B cslen;				/* length of context to search */
+
+    void *arena;			/* holds all arrays above */
+    int ready;				/* initialized and not used yet */
+};
+
+#define U16TABS		(2*HTLEN+4*NUMCON+2*NUMCFB)
+#define BYTETABS	(NUMCON*(sizeof(Context)+4)+NUMCFB)
+#define ARENALEN	(U16TABS*sizeof(U16B)+BYTETABS)
 
 /***********************************************************************
-	Cleanup routine
+	Cleanup routines
 ***********************************************************************/
 
-void hsc_cleanup(void)
+void hsc_cleanup(Codec *cx)
 {
 
-    if (ht!=NULL) free(ht),ht=NULL;
-    if (fc!=NULL) free(fc),fc=NULL;
-    if (fa!=NULL) free(fa),fa=NULL;
-    if (ft!=NULL) free(ft),ft=NULL;
-    if (fe!=NULL) free(fe),fe=NULL;
-    if (nb!=NULL) free(nb),nb=NULL;
-    if (hp!=NULL) free(hp),hp=NULL;
-    if (elp!=NULL) free(elp),elp=NULL;
-    if (eln!=NULL) free(eln),eln=NULL;
-    if (cl!=NULL) free(cl),cl=NULL;
-    if (cc!=NULL) free(cc),cc=NULL;
-    if (rfm!=NULL) free(rfm),rfm=NULL;
-    if (con!=NULL) free(con),con=NULL;
+    if (cx->hsc!=NULL) cx->hsc->ready=0;
+}
+
+void hsc_free(Codec *cx)
+{
+
+    register struct hscstate *hm=cx->hsc;
+
+    if (hm==NULL) return;
+    if (hm->arena!=NULL) md_freearena(hm->arena,ARENALEN);
+    free(hm);
+    cx->hsc=NULL;
 }
 
 
@@ -111,80 +122,91 @@ void hsc_cleanup(void)
 	System initialization
 ***********************************************************************/
 
-static  U16B make_context(unsigned char cl, S16B c);
+static  U16B make_context(struct hscstate *hm, unsigned char conlen, S16B c);
 
-static void init_model(void)
+static void init_model(Codec *cx)
 {
 
     register S16B i;
     S32B z,l,h,t;
+    register struct hscstate *hm;
+    void *arena=NULL;
+    U16B *p;
+    unsigned char *q;
 
-    ht=malloc(HTLEN*sizeof(*ht));
-    hp=malloc(NUMCON*sizeof(*hp));
-    elp=malloc(NUMCON*sizeof(*elp));
-    eln=malloc(NUMCON*sizeof(*eln));
-    cl=malloc(NUMCON*sizeof(*cl));
-    cc=malloc(NUMCON*sizeof(*cc));
-    ft=malloc(NUMCON*sizeof(*ft));
-    fe=malloc(NUMCON*sizeof(*fe));
-    rfm=malloc(NUMCON*sizeof(*rfm));
-    con=malloc(NUMCON*sizeof(*con));
-    fc=malloc(NUMCFB*sizeof(*fc));
-    fa=malloc(NUMCFB*sizeof(*fa));
-    nb=malloc(NUMCFB*sizeof(*nb));
-    if (hp==NULL || elp==NULL || eln==NULL ||
-            cl==NULL || rfm==NULL || con==NULL ||
-            cc==NULL || ft==NULL || fe==NULL ||
-            fc==NULL || fa==NULL || nb==NULL || ht==NULL)
+    if ((hm=cx->hsc)!=NULL) arena=hm->arena;
+    else if ((hm=cx->hsc=malloc(sizeof(*cx->hsc)))==NULL)
+        error(1,ERR_MEM,"init_model()");
+    memset(hm,0,sizeof(*hm));
+    if ((hm->arena=arena)==NULL && (hm->arena=md_arena(ARENALEN))==NULL)
     {
-        hsc_cleanup();
+        hsc_free(cx);
         error(1,ERR_MEM,"init_model()");
     }
-    maxclen=MAXCLEN;
-    iec[0]=(IECLIM>>1);
-    for (i=1; i<=MAXCLEN; ++i) iec[i]=(IECLIM>>1)-1;
-    dropcnt=NUMCON/4;
-    nec=0;
-    nrel=0;
-    hs[0]=0;
-    for (i=0; i<HTLEN; ++i) ht[i]=NIL;
+    p=hm->arena;				/* The arrays of the model */
+    hm->ht=p;
+    hm->hrt=p+=HTLEN;
+    hm->hp=p+=HTLEN;
+    hm->elp=p+=NUMCON;
+    hm->eln=p+=NUMCON;
+    hm->ft=p+=NUMCON;
+    hm->fa=p+=NUMCON;
+    hm->nb=p+=NUMCFB;
+    q=(unsigned char *)(p+NUMCFB);
+    hm->con=(Context *)q;
+    hm->cl=q+=NUMCON*sizeof(Context);
+    hm->cc=q+=NUMCON;
+    hm->fe=q+=NUMCON;
+    hm->rfm=q+=NUMCON;
+    hm->fc=q+NUMCON;
+    hm->maxclen=MAXCLEN;
+    hm->iec[0]=(IECLIM>>1);
+    for (i=1; i<=MAXCLEN; ++i) hm->iec[i]=(IECLIM>>1)-1;
+    hm->dropcnt=NUMCON/4;
+    hm->nec=0;
+    hm->nrel=0;
+    hm->hs[0]=0;
+    for (i=0; i<HTLEN; ++i) hm->ht[i]=NIL;
     for (i=0; i<NUMCON; ++i)
     {
-        eln[i]=i+1;
-        elp[i]=i-1;
-        cl[i]=0xff;
-        nb[i]=NIL;
+        hm->eln[i]=i+1;
+        hm->elp[i]=i-1;
+        hm->cl[i]=0xff;
+        hm->nb[i]=NIL;
     }
-    elf=0;
-    ell=NUMCON-1;
-    for (i=NUMCON; i<NUMCFB-1; ++i) nb[i]=i+1;
-    nb[i]=NIL;
-    fcfbl=NUMCON;
-    curcon[3]=curcon[2]=curcon[1]=curcon[0]=0;
-    cmsp=0;
-    for (i=0; i<256; ++i) cmask[i]=0;
+    hm->elf=0;
+    hm->ell=NUMCON-1;
+    for (i=NUMCON; i<NUMCFB-1; ++i) hm->nb[i]=i+1;
+    hm->nb[i]=NIL;
+    hm->fcfbl=NUMCON;
+    hm->curcon[3]=hm->curcon[2]=hm->curcon[1]=hm->curcon[0]=0;
+    hm->cmsp=0;
+    for (i=0; i<256; ++i) hm->cmask[i]=0;
+    if (arena!=NULL) return;		/* hrt[] is still there */
     for (z=10,i=0; i<HTLEN; ++i)
     {
         h=z/(2147483647L/16807L);
         l=z%(2147483647L/16807L);
         if ((t=16807L*l-(2147483647L%16807L)*h)>0) z=t;
         else z=t+2147483647L;
-        hrt[i]=(U16B)z&(HTLEN-1);
+        hm->hrt[i]=(U16B)z&(HTLEN-1);
     }
 }
 
-static void init_pack(void)
+static void init_pack(Codec *cx)
 {
 
-    init_model();
-    ac_init_encode();
+    if (cx->hsc==NULL || !cx->hsc->ready) init_model(cx);
+    cx->hsc->ready=0;
+    ac_init_encode(cx);
 }
 
-static void init_unpack(void)
+static void init_unpack(Codec *cx)
 {
 
-    init_model();
-    ac_init_decode();
+    if (cx->hsc==NULL || !cx->hsc->ready) init_model(cx);
+    cx->hsc->ready=0;
+    ac_init_decode(cx);
 }
 
 
@@ -194,197 +216,199 @@ static void init_unpack(void)
 
 #define HASH(s,l,h)	{				          \
 			  h=0;                                    \
-			  if (l) h=hrt[s[0]];                     \
-			  if (l>1) h=hrt[(s[1]+h)&(HTLEN-1)];     \
-			  if (l>2) h=hrt[(s[2]+h)&(HTLEN-1)];     \
-			  if (l>3) h=hrt[(s[3]+h)&(HTLEN-1)];     \
+			  if (l) h=hm->hrt[s[0]];                 \
+			  if (l>1) h=hm->hrt[(s[1]+h)&(HTLEN-1)]; \
+			  if (l>2) h=hm->hrt[(s[2]+h)&(HTLEN-1)]; \
+			  if (l>3) h=hm->hrt[(s[3]+h)&(HTLEN-1)]; \
 			}
 
-#define move_context(c) curcon[3]=curcon[2],curcon[2]=curcon[1], \
-			curcon[1]=curcon[0],curcon[0]=c
+#define move_context(c) hm->curcon[3]=hm->curcon[2],		  \
+			hm->curcon[2]=hm->curcon[1],			  \
+			hm->curcon[1]=hm->curcon[0],hm->curcon[0]=c
 
-static  void release_cfblocks(void)
+static  void release_cfblocks(struct hscstate *hm)
 {
 
     register U16B i,j,d;
 
     do
     {
-        do if (++nrel==NUMCON) nrel=0;
-        while (nb[nrel]==NIL);
-        for (i=0; i<=usp; ++i) if ((cps[i]&0x7fff)==nrel) break;
+        do if (++hm->nrel==NUMCON) hm->nrel=0;
+        while (hm->nb[hm->nrel]==NIL);
+        for (i=0; i<=hm->usp; ++i) if ((hm->cps[i]&0x7fff)==hm->nrel) break;
     }
-    while (i<=usp);
-    for (i=nb[nrel],d=fa[nrel]; i!=NIL; i=nb[i]) if (fa[i]<d) d=fa[i];
+    while (i<=hm->usp);
+    for (i=hm->nb[hm->nrel],d=hm->fa[hm->nrel]; i!=NIL; i=hm->nb[i])
+        if (hm->fa[i]<d) d=hm->fa[i];
     ++d;
-    if (fa[nrel]<d)
+    if (hm->fa[hm->nrel]<d)
     {
-        for (i=nb[nrel]; fa[i]<d && nb[i]!=NIL; i=nb[i]);
-        fa[nrel]=fa[i];
-        fc[nrel]=fc[i];
-        j=nb[i];
-        nb[i]=fcfbl;
-        fcfbl=nb[nrel];
-        if ((nb[nrel]=j)==NIL)
+        for (i=hm->nb[hm->nrel]; hm->fa[i]<d && hm->nb[i]!=NIL; i=hm->nb[i]);
+        hm->fa[hm->nrel]=hm->fa[i];
+        hm->fc[hm->nrel]=hm->fc[i];
+        j=hm->nb[i];
+        hm->nb[i]=hm->fcfbl;
+        hm->fcfbl=hm->nb[hm->nrel];
+        if ((hm->nb[hm->nrel]=j)==NIL)
         {
-            cc[nrel]=0;
-            fe[nrel]=(ft[nrel]=fa[nrel])<ESCTH?1:0;
+            hm->cc[hm->nrel]=0;
+            hm->fe[hm->nrel]=(hm->ft[hm->nrel]=hm->fa[hm->nrel])<ESCTH?1:0;
             return;
         }
     }
-    fe[nrel]=(ft[nrel]=fa[nrel]/=d)<ESCTH?1:0;
-    cc[nrel]=0;
-    for (j=nrel,i=nb[j]; i!=NIL;)
+    hm->fe[hm->nrel]=(hm->ft[hm->nrel]=hm->fa[hm->nrel]/=d)<ESCTH?1:0;
+    hm->cc[hm->nrel]=0;
+    for (j=hm->nrel,i=hm->nb[j]; i!=NIL;)
     {
-        if (fa[i]<d)
+        if (hm->fa[i]<d)
         {
-            nb[j]=nb[i];
-            nb[i]=fcfbl;
-            fcfbl=i;
-            i=nb[j];
+            hm->nb[j]=hm->nb[i];
+            hm->nb[i]=hm->fcfbl;
+            hm->fcfbl=i;
+            i=hm->nb[j];
         }
         else
         {
-            ++cc[nrel];
-            ft[nrel]+=fa[i]/=d;
-            if (fa[i]<ESCTH) fe[nrel]++;
+            ++hm->cc[hm->nrel];
+            hm->ft[hm->nrel]+=hm->fa[i]/=d;
+            if (hm->fa[i]<ESCTH) hm->fe[hm->nrel]++;
             j=i;
-            i=nb[i];
+            i=hm->nb[i];
         }
     }
 }
 
-static  U16B make_context(unsigned char conlen, S16B c)
+static  U16B make_context(struct hscstate *hm, unsigned char conlen, S16B c)
 {
 
     register S16B i;
     register U16B nc,fp;
 
-    nc=ell;
-    ell=elp[nc];
-    elp[elf]=nc;
-    eln[nc]=elf;
-    elf=nc;
-    if (cl[nc]!=0xff)
+    nc=hm->ell;
+    hm->ell=hm->elp[nc];
+    hm->elp[hm->elf]=nc;
+    hm->eln[nc]=hm->elf;
+    hm->elf=nc;
+    if (hm->cl[nc]!=0xff)
     {
-        if (cl[nc]==MAXCLEN && --dropcnt==0) maxclen=MAXCLEN-1;
-        HASH(con[nc],cl[nc],i);
-        if (ht[i]==nc) ht[i]=hp[nc];
+        if (hm->cl[nc]==MAXCLEN && --hm->dropcnt==0) hm->maxclen=MAXCLEN-1;
+        HASH(hm->con[nc],hm->cl[nc],i);
+        if (hm->ht[i]==nc) hm->ht[i]=hm->hp[nc];
         else
         {
-            for (i=ht[i]; hp[i]!=nc; i=hp[i]);
-            hp[i]=hp[nc];
+            for (i=hm->ht[i]; hm->hp[i]!=nc; i=hm->hp[i]);
+            hm->hp[i]=hm->hp[nc];
         }
-        if (nb[nc]!=NIL)
+        if (hm->nb[nc]!=NIL)
         {
-            for (fp=nb[nc]; nb[fp]!=NIL; fp=nb[fp]);
-            nb[fp]=fcfbl;
-            fcfbl=nb[nc];
+            for (fp=hm->nb[nc]; hm->nb[fp]!=NIL; fp=hm->nb[fp]);
+            hm->nb[fp]=hm->fcfbl;
+            hm->fcfbl=hm->nb[nc];
         }
     }
-    nb[nc]=NIL;
-    fe[nc]=ft[nc]=fa[nc]=1;
-    fc[nc]=c;
-    rfm[nc]=RFMINI;
-    cc[nc]=0;
-    cl[nc]=conlen;
-    con[nc][0]=curcon[0];
-    con[nc][1]=curcon[1];
-    con[nc][2]=curcon[2];
-    con[nc][3]=curcon[3];
-    HASH(curcon,conlen,i);
-    hp[nc]=ht[i];
-    ht[i]=nc;
+    hm->nb[nc]=NIL;
+    hm->fe[nc]=hm->ft[nc]=hm->fa[nc]=1;
+    hm->fc[nc]=c;
+    hm->rfm[nc]=RFMINI;
+    hm->cc[nc]=0;
+    hm->cl[nc]=conlen;
+    hm->con[nc][0]=hm->curcon[0];
+    hm->con[nc][1]=hm->curcon[1];
+    hm->con[nc][2]=hm->curcon[2];
+    hm->con[nc][3]=hm->curcon[3];
+    HASH(hm->curcon,conlen,i);
+    hm->hp[nc]=hm->ht[i];
+    hm->ht[i]=nc;
     return nc;
 }
 
-static  void el_movefront(U16B cp)
+static  void el_movefront(struct hscstate *hm, U16B cp)
 {
 
-    if (cp==elf) return;
-    if (cp==ell) ell=elp[cp];
+    if (cp==hm->elf) return;
+    if (cp==hm->ell) hm->ell=hm->elp[cp];
     else
     {
-        elp[eln[cp]]=elp[cp];
-        eln[elp[cp]]=eln[cp];
+        hm->elp[hm->eln[cp]]=hm->elp[cp];
+        hm->eln[hm->elp[cp]]=hm->eln[cp];
     }
-    elp[elf]=cp;
-    eln[cp]=elf;
-    elf=cp;
+    hm->elp[hm->elf]=cp;
+    hm->eln[cp]=hm->elf;
+    hm->elf=cp;
 }
 
-static void  add_model(S16B c)
+static void  add_model(struct hscstate *hm, S16B c)
 {
 
     register U16B i;
     register S16B cp;
 
-    while (usp!=0)
+    while (hm->usp!=0)
     {
-        i=as[--usp];
-        cp=cps[usp];
+        i=hm->as[--hm->usp];
+        cp=hm->cps[hm->usp];
         if (cp&0x8000)
         {
             cp&=0x7fff;
-            if (fcfbl==NIL) release_cfblocks();
-            nb[i]=fcfbl;
-            i=nb[i];
-            fcfbl=nb[fcfbl];
-            nb[i]=NIL;
-            fa[i]=1;
-            fc[i]=c;
-            ++cc[cp];
-            ++fe[cp];
+            if (hm->fcfbl==NIL) release_cfblocks(hm);
+            hm->nb[i]=hm->fcfbl;
+            i=hm->nb[i];
+            hm->fcfbl=hm->nb[hm->fcfbl];
+            hm->nb[i]=NIL;
+            hm->fa[i]=1;
+            hm->fc[i]=c;
+            ++hm->cc[cp];
+            ++hm->fe[cp];
         }
-        else if (++fa[i]==ESCTH) --fe[cp];
-        if ((fa[i]<<1)<++ft[cp]/(cc[cp]+1)) --rfm[cp];
-        else if (rfm[cp]<RFMINI) ++rfm[cp];
-        if (!rfm[cp] || ft[cp]>=MAXTVAL)
+        else if (++hm->fa[i]==ESCTH) --hm->fe[cp];
+        if ((hm->fa[i]<<1)<++hm->ft[cp]/(hm->cc[cp]+1)) --hm->rfm[cp];
+        else if (hm->rfm[cp]<RFMINI) ++hm->rfm[cp];
+        if (!hm->rfm[cp] || hm->ft[cp]>=MAXTVAL)
         {
-            ++rfm[cp];
-            fe[cp]=ft[cp]=0;
-            for (i=cp; i!=NIL; i=nb[i])
+            ++hm->rfm[cp];
+            hm->fe[cp]=hm->ft[cp]=0;
+            for (i=cp; i!=NIL; i=hm->nb[i])
             {
-                if (fa[i]>1)
+                if (hm->fa[i]>1)
                 {
-                    ft[cp]+=fa[i]>>=1;
-                    if (fa[i]<ESCTH) ++fe[cp];
+                    hm->ft[cp]+=hm->fa[i]>>=1;
+                    if (hm->fa[i]<ESCTH) ++hm->fe[cp];
                 }
                 else
                 {
-                    ++ft[cp];
-                    ++fe[cp];
+                    ++hm->ft[cp];
+                    ++hm->fe[cp];
                 }
             }
         }
     }
 }
 
-static  U16B find_next(void)
+static  U16B find_next(struct hscstate *hm)
 {
 
     register S16B i,k;
     register U16B cp;
 
-    for (i=cslen-1; i>=0; --i)
+    for (i=hm->cslen-1; i>=0; --i)
     {
-        k=hs[i];
-        for (cp=ht[k]; cp!=NIL; cp=hp[cp])
+        k=hm->hs[i];
+        for (cp=hm->ht[k]; cp!=NIL; cp=hm->hp[cp])
         {
-            if (cl[cp]==i)
+            if (hm->cl[cp]==i)
             {
                 switch (i)
                 {
                 case 4:
-                    if (curcon[3]!=con[cp][3]) break;
+                    if (hm->curcon[3]!=hm->con[cp][3]) break;
                 case 3:
-                    if (curcon[2]!=con[cp][2]) break;
+                    if (hm->curcon[2]!=hm->con[cp][2]) break;
                 case 2:
-                    if (curcon[1]!=con[cp][1]) break;
+                    if (hm->curcon[1]!=hm->con[cp][1]) break;
                 case 1:
-                    if (curcon[0]!=con[cp][0]) break;
+                    if (hm->curcon[0]!=hm->con[cp][0]) break;
                 case 0:
-                    cslen=i;
+                    hm->cslen=i;
                     return cp;
                 }
             }
@@ -393,55 +417,56 @@ static  U16B find_next(void)
     return NIL;
 }
 
-static  U16B find_longest(void)
+static  U16B find_longest(struct hscstate *hm)
 {
 
-    hs[1]=hrt[curcon[0]];
-    hs[2]=hrt[(curcon[1]+hs[1])&(HTLEN-1)];
-    hs[3]=hrt[(curcon[2]+hs[2])&(HTLEN-1)];
-    hs[4]=hrt[(curcon[3]+hs[3])&(HTLEN-1)];
-    usp=0;
-    while(cmsp) cmask[cmstack[--cmsp]]=0;
-    cslen=MAXCLEN+1;
-    return find_next();
+    hm->hs[1]=hm->hrt[hm->curcon[0]];
+    hm->hs[2]=hm->hrt[(hm->curcon[1]+hm->hs[1])&(HTLEN-1)];
+    hm->hs[3]=hm->hrt[(hm->curcon[2]+hm->hs[2])&(HTLEN-1)];
+    hm->hs[4]=hm->hrt[(hm->curcon[3]+hm->hs[3])&(HTLEN-1)];
+    hm->usp=0;
+    while(hm->cmsp) hm->cmask[hm->cmstack[--hm->cmsp]]=0;
+    hm->cslen=MAXCLEN+1;
+    return find_next(hm);
 }
 
-static U16B adj_escape_prob(U16B esc, U16B cp)
+static U16B adj_escape_prob(struct hscstate *hm, U16B esc, U16B cp)
 {
 
-    if (ft[cp]==1) return iec[cl[cp]]>=(IECLIM>>1)?2:1;
-    if (cc[cp]==255) return 1;
-    if (cc[cp] && ((cc[cp]+1)<<1)>=ft[cp])
+    if (hm->ft[cp]==1) return hm->iec[hm->cl[cp]]>=(IECLIM>>1)?2:1;
+    if (hm->cc[cp]==255) return 1;
+    if (hm->cc[cp] && ((hm->cc[cp]+1)<<1)>=hm->ft[cp])
     {
-        esc=(S16B)((S32B)esc*((cc[cp]+1)<<1)/ft[cp]);
-        if (cc[cp]+1==ft[cp]) esc+=(cc[cp]+1)>>1;
+        esc=(S16B)((S32B)esc*((hm->cc[cp]+1)<<1)/hm->ft[cp]);
+        if (hm->cc[cp]+1==hm->ft[cp]) esc+=(hm->cc[cp]+1)>>1;
     }
     return esc?esc:1;
 }
 
 
-static  S16B code_first(U16B cp, S16B c)
+static  S16B code_first(Codec *cx, U16B cp, S16B c)
 {
 
     register U16B i;
     register S16B sum,cf,tot,esc;
+    register struct hscstate *hm=cx->hsc;
 
     sum=cf=0;
-    for (i=cp; i!=NIL; i=nb[i])
+    for (i=cp; i!=NIL; i=hm->nb[i])
     {
-        if (fc[i]==c)
+        if (hm->fc[i]==c)
         {
-            cf=fa[i];
-            as[0]=i;
+            cf=hm->fa[i];
+            hm->as[0]=i;
             break;
         }
-        sum+=fa[i];
+        sum+=hm->fa[i];
     }
-    tot=ft[cp];
-    esc=adj_escape_prob(fe[cp],cp);
-    if (nec>=NECLIM)
+    tot=hm->ft[cp];
+    esc=adj_escape_prob(hm,hm->fe[cp],cp);
+    if (hm->nec>=NECLIM)
     {
-        if (tot<=NECTLIM && nec==NECMAX)
+        if (tot<=NECTLIM && hm->nec==NECMAX)
         {
             tot<<=2;
             sum<<=2;
@@ -454,87 +479,89 @@ static  S16B code_first(U16B cp, S16B c)
             cf<<=1;
         }
     }
-    usp=1;
+    hm->usp=1;
     if (cf==0)
     {
-        ac_out(tot,tot+esc,tot+esc);
-        for (i=cp; i!=NIL; sum=i,i=nb[i])
+        ac_out(cx,tot,tot+esc,tot+esc);
+        for (i=cp; i!=NIL; sum=i,i=hm->nb[i])
         {
-            cmstack[cmsp++]=fc[i];
-            cmask[fc[i]]=1;
+            hm->cmstack[hm->cmsp++]=hm->fc[i];
+            hm->cmask[hm->fc[i]]=1;
         }
-        as[0]=sum;  /* sum holds last i ! */
-        nec=0;
-        if (ft[cp]==1 && iec[cl[cp]]<IECLIM) ++iec[cl[cp]];
-        cps[0]=0x8000|cp;
+        hm->as[0]=sum;  /* sum holds last i ! */
+        hm->nec=0;
+        if (hm->ft[cp]==1 && hm->iec[hm->cl[cp]]<IECLIM) ++hm->iec[hm->cl[cp]];
+        hm->cps[0]=0x8000|cp;
         return 0;
     }
-    ac_out(sum,sum+cf,tot+esc);
-    if (nec<NECMAX) ++nec;
-    if (ft[cp]==1 && iec[cl[cp]]) --iec[cl[cp]];
-    cps[0]=cp;
+    ac_out(cx,sum,sum+cf,tot+esc);
+    if (hm->nec<NECMAX) ++hm->nec;
+    if (hm->ft[cp]==1 && hm->iec[hm->cl[cp]]) --hm->iec[hm->cl[cp]];
+    hm->cps[0]=cp;
     return 1;
 }
 
 
-static  S16B code_rest(U16B cp, S16B c)
+static  S16B code_rest(Codec *cx, U16B cp, S16B c)
 {
 
     register U16B i;
     register S16B sum,cf,tot,esc;
+    register struct hscstate *hm=cx->hsc;
 
     tot=sum=cf=esc=0;
-    for (i=cp; i!=NIL; i=nb[i])
+    for (i=cp; i!=NIL; i=hm->nb[i])
     {
-        if (!cmask[fc[i]])
+        if (!hm->cmask[hm->fc[i]])
         {
-            if (fa[i]<ESCTH) ++esc;
-            if (cf==0 && fc[i]==c)
+            if (hm->fa[i]<ESCTH) ++esc;
+            if (cf==0 && hm->fc[i]==c)
             {
                 sum=tot;
-                cf=fa[i];
-                as[usp]=i;
+                cf=hm->fa[i];
+                hm->as[hm->usp]=i;
             }
-            tot+=fa[i];
+            tot+=hm->fa[i];
         }
     }
-    esc=adj_escape_prob(esc,cp);
+    esc=adj_escape_prob(hm,esc,cp);
     if (cf==0)
     {
-        ac_out(tot,tot+esc,tot+esc);
-        for (i=cp; i!=NIL; sum=i,i=nb[i])
+        ac_out(cx,tot,tot+esc,tot+esc);
+        for (i=cp; i!=NIL; sum=i,i=hm->nb[i])
         {
-            if (!cmask[fc[i]])
+            if (!hm->cmask[hm->fc[i]])
             {
-                cmstack[cmsp++]=fc[i];
-                cmask[fc[i]]=1;
+                hm->cmstack[hm->cmsp++]=hm->fc[i];
+                hm->cmask[hm->fc[i]]=1;
             }
         }
-        as[usp]=sum;  /* sum holds last i ! */
-        if (ft[cp]==1 && iec[cl[cp]]<IECLIM) ++iec[cl[cp]];
-        cps[usp++]=0x8000|cp;
+        hm->as[hm->usp]=sum;  /* sum holds last i ! */
+        if (hm->ft[cp]==1 && hm->iec[hm->cl[cp]]<IECLIM) ++hm->iec[hm->cl[cp]];
+        hm->cps[hm->usp++]=0x8000|cp;
         return 0;
     }
-    ac_out(sum,sum+cf,tot+esc);
-    ++nec;   /* must add test used in code_first() if NECMAX<5 ! */
-    if (ft[cp]==1 && iec[cl[cp]]) --iec[cl[cp]];
-    cps[usp++]=cp;
+    ac_out(cx,sum,sum+cf,tot+esc);
+    ++hm->nec;   /* must add test used in code_first() if NECMAX<5 ! */
+    if (hm->ft[cp]==1 && hm->iec[hm->cl[cp]]) --hm->iec[hm->cl[cp]];
+    hm->cps[hm->usp++]=cp;
     return 1;
 }
 
-static  void code_new(S16B c)
+static  void code_new(Codec *cx, S16B c)
 {
 
     register S16B i;
     register U16B sum,tot;
+    register struct hscstate *hm=cx->hsc;
 
     sum=0;
-    tot=257-cmsp;
-    for (i=0; i<c; ++i) sum+=1-cmask[i];
-    ac_out(sum,sum+1,tot);
+    tot=257-hm->cmsp;
+    for (i=0; i<c; ++i) sum+=1-hm->cmask[i];
+    ac_out(cx,sum,sum+1,tot);
 }
 
-static  S16B decode_first(U16B cp)
+static  S16B decode_first(Codec *cx, U16B cp)
 {
 
     register U16B c;
@@ -542,22 +569,23 @@ static  S16B decode_first(U16B cp)
     register U16B i;
     register S16B sum,tot,esc,cf;
     register unsigned char sv;
+    register struct hscstate *hm=cx->hsc;
 
-    esc=adj_escape_prob(fe[cp],cp);
-    tot=ft[cp];
-    if (nec>=NECLIM)
+    esc=adj_escape_prob(hm,hm->fe[cp],cp);
+    tot=hm->ft[cp];
+    if (hm->nec>=NECLIM)
     {
-        if (tot<=NECTLIM && nec==NECMAX) sv=2;
+        if (tot<=NECTLIM && hm->nec==NECMAX) sv=2;
         else sv=1;
         tot<<=sv;
-        tv=ac_threshold_val(tot+esc)>>sv;
-        for (c=cp,sum=0;; c=nb[c])
+        tv=ac_threshold_val(cx,tot+esc)>>sv;
+        for (c=cp,sum=0;; c=hm->nb[c])
         {
             if (c==NIL) break;
-            if (sum+fa[c]<=tv) sum+=fa[c];
+            if (sum+hm->fa[c]<=tv) sum+=hm->fa[c];
             else
             {
-                cf=fa[c]<<sv;
+                cf=hm->fa[c]<<sv;
                 break;
             }
         }
@@ -565,210 +593,234 @@ static  S16B decode_first(U16B cp)
     }
     else
     {
-        tv=ac_threshold_val(tot+esc);
-        for (c=cp,sum=0;; c=nb[c])
+        tv=ac_threshold_val(cx,tot+esc);
+        for (c=cp,sum=0;; c=hm->nb[c])
         {
             if (c==NIL) break;
-            if (sum+fa[c]<=tv) sum+=fa[c];
+            if (sum+hm->fa[c]<=tv) sum+=hm->fa[c];
             else
             {
-                cf=fa[c];
+                cf=hm->fa[c];
                 break;
             }
         }
     }
-    usp=1;
+    hm->usp=1;
     if (c!=NIL)
     {
-        ac_in(sum,sum+cf,tot+esc);
-        if (ft[cp]==1 && iec[cl[cp]]) --iec[cl[cp]];
-        as[0]=c;
-        cps[0]=cp;
-        c=fc[c];
-        if (nec<NECMAX) ++nec;
+        ac_in(cx,sum,sum+cf,tot+esc);
+        if (hm->ft[cp]==1 && hm->iec[hm->cl[cp]]) --hm->iec[hm->cl[cp]];
+        hm->as[0]=c;
+        hm->cps[0]=cp;
+        c=hm->fc[c];
+        if (hm->nec<NECMAX) ++hm->nec;
     }
     else
     {
-        ac_in(tot,tot+esc,tot+esc);
-        if (ft[cp]==1 && iec[cl[cp]]<IECLIM) ++iec[cl[cp]];
-        for (i=cp; i!=NIL; sum=i,i=nb[i])
+        ac_in(cx,tot,tot+esc,tot+esc);
+        if (hm->ft[cp]==1 && hm->iec[hm->cl[cp]]<IECLIM) ++hm->iec[hm->cl[cp]];
+        for (i=cp; i!=NIL; sum=i,i=hm->nb[i])
         {
-            cmstack[cmsp++]=fc[i];
-            cmask[fc[i]]=1;
+            hm->cmstack[hm->cmsp++]=hm->fc[i];
+            hm->cmask[hm->fc[i]]=1;
         }
-        cps[0]=0x8000|cp;
-        as[0]=sum;
+        hm->cps[0]=0x8000|cp;
+        hm->as[0]=sum;
         c=ESC;
-        nec=0;
+        hm->nec=0;
     }
     return c;
 }
 
-static  S16B decode_rest(U16B cp)
+static  S16B decode_rest(Codec *cx, U16B cp)
 {
 
     register U16B c;
     register U16B tv;
     register U16B i;
     register S16B sum,tot,esc,cf;
+    register struct hscstate *hm=cx->hsc;
 
     esc=tot=0;
-    for (i=cp; i!=NIL; i=nb[i])
+    for (i=cp; i!=NIL; i=hm->nb[i])
     {
-        if (!cmask[fc[i]])
+        if (!hm->cmask[hm->fc[i]])
         {
-            tot+=fa[i];
-            if (fa[i]<ESCTH) ++esc;
+            tot+=hm->fa[i];
+            if (hm->fa[i]<ESCTH) ++esc;
         }
     }
-    esc=adj_escape_prob(esc,cp);
-    tv=ac_threshold_val(tot+esc);
-    for (c=cp,sum=0;; c=nb[c])
+    esc=adj_escape_prob(hm,esc,cp);
+    tv=ac_threshold_val(cx,tot+esc);
+    for (c=cp,sum=0;; c=hm->nb[c])
     {
         if (c==NIL) break;
-        if (!cmask[fc[c]])
+        if (!hm->cmask[hm->fc[c]])
         {
-            if (sum+fa[c]<=tv) sum+=fa[c];
+            if (sum+hm->fa[c]<=tv) sum+=hm->fa[c];
             else
             {
-                cf=fa[c];
+                cf=hm->fa[c];
                 break;
             }
         }
     }
     if (c!=NIL)
     {
-        ac_in(sum,sum+cf,tot+esc);
-        if (ft[cp]==1 && iec[cl[cp]]) --iec[cl[cp]];
-        as[usp]=c;
-        cps[usp++]=cp;
-        c=fc[c];
-        ++nec;  /* must add test used in code_first() if NECMAX<5 ! */
+        ac_in(cx,sum,sum+cf,tot+esc);
+        if (hm->ft[cp]==1 && hm->iec[hm->cl[cp]]) --hm->iec[hm->cl[cp]];
+        hm->as[hm->usp]=c;
+        hm->cps[hm->usp++]=cp;
+        c=hm->fc[c];
+        ++hm->nec;  /* must add test used in code_first() if NECMAX<5 ! */
     }
     else
     {
-        ac_in(tot,tot+esc,tot+esc);
-        if (ft[cp]==1 && iec[cl[cp]]<IECLIM) ++iec[cl[cp]];
-        for (i=cp; i!=NIL; sum=i,i=nb[i])
+        ac_in(cx,tot,tot+esc,tot+esc);
+        if (hm->ft[cp]==1 && hm->iec[hm->cl[cp]]<IECLIM) ++hm->iec[hm->cl[cp]];
+        for (i=cp; i!=NIL; sum=i,i=hm->nb[i])
         {
-            if (!cmask[fc[i]])
+            if (!hm->cmask[hm->fc[i]])
             {
-                cmstack[cmsp++]=fc[i];
-                cmask[fc[i]]=1;
+                hm->cmstack[hm->cmsp++]=hm->fc[i];
+                hm->cmask[hm->fc[i]]=1;
             }
         }
-        cps[usp]=0x8000|cp;
-        as[usp++]=sum;		/* sum holds last i !! */
+        hm->cps[hm->usp]=0x8000|cp;
+        hm->as[hm->usp++]=sum;		/* sum holds last i !! */
         c=ESC;
     }
     return c;
 }
 
-static  S16B decode_new(void)
+static  S16B decode_new(Codec *cx)
 {
 
     register S16B c;
     register U16B tv,sum,tot;
+    register struct hscstate *hm=cx->hsc;
 
-    tot=257-cmsp;
-    tv=ac_threshold_val(tot);
+    tot=257-hm->cmsp;
+    tv=ac_threshold_val(cx,tot);
     for (c=sum=0; c<256; ++c)
     {
-        if (cmask[c]) continue;
+        if (hm->cmask[c]) continue;
         if (sum+1<=tv) ++sum;
         else break;
     }
-    ac_in(sum,sum+1,tot);
+    ac_in(cx,sum,sum+1,tot);
     return c;
 }
 
-#define code_byte(cp,c) (cmsp?code_rest(cp,c):code_first(cp,c))
-#define decode_byte(cp) (cmsp?decode_rest(cp):decode_first(cp))
+#define code_byte(cp,c) (hm->cmsp?code_rest(cx,cp,c):code_first(cx,cp,c))
+#define decode_byte(cp) (hm->cmsp?decode_rest(cx,cp):decode_first(cx,cp))
 
 /***********************************************************************
 	Encoding
 ***********************************************************************/
 
-void hsc_pack(void)
+static void pack_char(Codec *cx, S16B c)
 {
 
-    S16B c;
     U16B cp;
     unsigned char ncmax,ncmin;
+    register struct hscstate *hm=cx->hsc;
 
-    init_pack();
-    for (; (c=getbyte())>=0;)
+    cp=find_longest(hm);
+    ncmin=cp==NIL?0:hm->cl[cp]+1;
+    ncmax=hm->maxclen+1;
+    for(;;)
     {
-        cp=find_longest();
-        ncmin=cp==NIL?0:cl[cp]+1;
-        ncmax=maxclen+1;
-        for(;;)
+        if (cp==NIL)
         {
-            if (cp==NIL)
-            {
-                code_new(c);
-                break;
-            }
-            if (code_byte(cp,c))
-            {
-                el_movefront(cp);
-                break;
-            }
-            cp=find_next();
+            code_new(cx,c);
+            break;
         }
-        add_model(c);
-        while (ncmax>ncmin) make_context(--ncmax,c);
-        move_context(c);
+        if (code_byte(cp,c))
+        {
+            el_movefront(hm,cp);
+            break;
+        }
+        cp=find_next(hm);
     }
-    cp=find_longest();
+    add_model(hm,c);
+    while (ncmax>ncmin) make_context(hm,--ncmax,c);
+    move_context(c);
+}
+
+void hsc_prime(Codec *cx, unsigned char *buf, U32B len)
+{
+
+    U32B i;
+
+    init_model(cx);
+    setoutput(&cx->io,-1,0,"none");
+    ac_init_encode(cx);
+    for (i=0; i<len; ++i) pack_char(cx,buf[i]);
+    cx->hsc->ready=1;
+}
+
+void hsc_pack(Codec *cx)
+{
+
+    S16B c;
+    U16B cp;
+    register struct hscstate *hm;
+
+    init_pack(cx);
+    hm=cx->hsc;
+    while ((c=getbyte(&cx->io))>=0) pack_char(cx,c);
+    cp=find_longest(hm);
     while (cp!=NIL)
     {
         code_byte(cp,ESC);
-        cp=find_next();
+        cp=find_next(hm);
     }
-    code_new(ESC);
-    ac_end_encode();
-    hsc_cleanup();
+    code_new(cx,ESC);
+    ac_end_encode(cx);
+    hsc_cleanup(cx);
 }
 
 /***********************************************************************
 	Decoding
 ***********************************************************************/
 
-void hsc_unpack(void)
+void hsc_unpack(Codec *cx)
 {
 
     S16B c;
     U16B cp;
     unsigned char ncmax,ncmin;
+    register struct hscstate *hm;
 
-    init_unpack();
+    init_unpack(cx);
+    hm=cx->hsc;
     for (;;)
     {
-        cp=find_longest();
-        ncmin=cp==NIL?0:cl[cp]+1;
-        ncmax=maxclen+1;
+        cp=find_longest(hm);
+        ncmin=cp==NIL?0:hm->cl[cp]+1;
+        ncmax=hm->maxclen+1;
         for(;;)
         {
             if (cp==NIL)
             {
-                c=decode_new();
+                c=decode_new(cx);
                 break;
             }
             if ((c=decode_byte(cp))!=ESC)
             {
-                el_movefront(cp);
+                el_movefront(hm,cp);
                 break;
             }
-            cp=find_next();
+            cp=find_next(hm);
         }
         if (c==ESC) break;
-        add_model(c);
-        while (ncmax>ncmin) make_context(--ncmax,c);
-        putbyte(c);
+        add_model(hm,c);
+        while (ncmax>ncmin) make_context(hm,--ncmax,c);
+        putbyte(&cx->io,c);
         move_context(c);
     }
-    flush();
-    hsc_cleanup();
+    flush(&cx->io);
+    hsc_cleanup(cx);
 }
 
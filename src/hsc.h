@@ -22,17 +22,27 @@
 /*	HSC method packing function
 */
 
-void hsc_pack(void);
+void hsc_pack(Codec *cx);
 
 
 /*	HSC method unpacking function
 */
 
-void hsc_unpack(void);
+void hsc_unpack(Codec *cx);
 
-/*	Cleanup for HSC method
+
+/*	Build a model from len bytes at buf without producing output.
+	The following hsc_pack() or hsc_unpack() continues from it.
+	Both sides must prime with the same data.
+*/
+
+void hsc_prime(Codec *cx, unsigned char *buf, U32B len);
+
+/*	Cleanup for HSC method. The model arrays are kept for the next
+	run in the same context until hsc_free().
 */
-void hsc_cleanup(void);
+void hsc_cleanup(Codec *cx);
+void hsc_free(Codec *cx);
 
 /*	Cleanup for error conditions
 */
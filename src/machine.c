@@ -19,11 +19,14 @@
 	HA *nix specific routines
 ***********************************************************************/
 
+#define _GNU_SOURCE			/* copy_file_range()		*/
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <utime.h>
 #include <time.h>
 #include "ha.h"
@@ -174,22 +177,11 @@ static char *attrstring(unsigned haattr)
     return as;
 }
 
-void md_gethdr(int len, int mode)
+void md_gethdr(unsigned char *buf, int len, int mode)
 {
 
-    static int longest=0;
-    static unsigned char *buf=NULL;
-
-    if (len>longest)
-    {
-        if (buf!=NULL) buf=realloc(buf,len);
-        else buf=malloc(len);
-        if (buf==NULL) error(1,ERR_MEM,"md_gethdr()");
-        longest=len;
-    }
-    read(arcfile,buf,len);
-    mdhd.mtype=buf[0];
-    if (mdhd.mtype==UNIXMDH)
+    mdhd.mtype=len?buf[0]:0;
+    if (mdhd.mtype==UNIXMDH && len>=MDHDLEN)
     {
         mdhd.attr=buf[1]|(buf[2]<<8);
         mdhd.user=buf[3]|(buf[4]<<8);
@@ -210,11 +202,9 @@ void md_gethdr(int len, int mode)
     }
 }
 
-void md_puthdr(void)
+void md_puthdr(unsigned char *buf)
 {
 
-    unsigned char buf[MDHDLEN];
-
     buf[0]=UNIXMDH;
     buf[1]=mdhd.attr&0xff;
     buf[2]=(mdhd.attr>>8)&0xff;
@@ -222,7 +212,6 @@ void md_puthdr(void)
     buf[4]=(mdhd.user>>8)&0xff;
     buf[5]=mdhd.group&0xff;
     buf[6]=(mdhd.group>>8)&0xff;
-    write(arcfile,buf,MDHDLEN);
 }
 
 int md_filetype(char *path, char *name)
@@ -400,6 +389,131 @@ void md_truncfile(int fh, U32B len)
     ftruncate(fh,len);
 }
 
+/*	Copy len bytes within file fh from from to to (to<from) without
+	passing them through user space. The chunks never overlap. Returns
+	the number of bytes copied, the caller does the rest.
+*/
+
+#define COPYMIN		(64UL<<10)
+
+U32B md_copyrange(int fh, U32B from, U32B to, U32B len)
+{
+
+#ifdef __linux__
+    U32B done,n;
+    loff_t in,out;
+    ssize_t got;
+
+    if (from-to<COPYMIN) return 0;
+    for (done=0; done<len; done+=got)
+    {
+        n=len-done<from-to?len-done:from-to;
+        in=from+done;
+        out=to+done;
+        if ((got=copy_file_range(fh,&in,fh,&out,n,0))<=0) break;
+    }
+    return done;
+#else
+    return 0;
+#endif
+}
+
+/*	A file that shrinks while mapped raises SIGBUS on the lost pages.
+	These are replaced with zeroes so the reader can go on, and
+	md_mapok() tells the caller to read the file again.
+*/
+
+static unsigned char *mapbase;
+static U32B maplen;
+static volatile sig_atomic_t mapbad;
+
+static void bus_handler(int signo, siginfo_t *si, void *uc)
+{
+
+    unsigned char *p=si->si_addr;
+    long pg=sysconf(_SC_PAGESIZE);
+
+    if (mapbase==NULL || p<mapbase || p>=mapbase+maplen)
+    {
+        signal(SIGBUS,SIG_DFL);
+        return;
+    }
+    p=mapbase+(p-mapbase)/pg*pg;
+    if (mmap(p,pg,PROT_READ,MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED,-1,0)
+            ==MAP_FAILED) signal(SIGBUS,SIG_DFL);
+    mapbad=1;
+}
+
+unsigned char *md_mapfile(int fh, U32B len)
+{
+
+    static int handled=0;
+    struct sigaction sa;
+    struct stat st;
+    void *map;
+
+    if (len==0 || mapbase!=NULL || fstat(fh,&st)!=0 ||
+            !S_ISREG(st.st_mode) || (U32B)st.st_size!=len)
+        return NULL;
+    if (!handled)
+    {
+        memset(&sa,0,sizeof(sa));
+        sa.sa_sigaction=bus_handler;
+        sa.sa_flags=SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGBUS,&sa,NULL)!=0) return NULL;
+        handled=1;
+    }
+    if ((map=mmap(NULL,len,PROT_READ,MAP_PRIVATE,fh,0))==MAP_FAILED)
+        return NULL;
+    madvise(map,len,MADV_SEQUENTIAL);
+    mapbad=0;
+    maplen=len;
+    mapbase=map;
+    return map;
+}
+
+int md_mapok(unsigned char *map)
+{
+
+    return map!=mapbase || !mapbad;
+}
+
+void md_unmapfile(unsigned char *map, U32B len)
+{
+
+    if (map==mapbase) mapbase=NULL;
+    munmap(map,len);
+}
+
+/*	Memory for the tables of a codec. Large arenas are mapped
+	directly and may use huge pages, which saves TLB misses on the
+	hash tables of large windows.
+*/
+
+#define HUGEMIN		(2UL<<20)
+
+void *md_arena(U32B size)
+{
+
+    void *p;
+
+    if (size<HUGEMIN) return malloc(size);
+    if ((p=mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,
+                -1,0))==MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+    madvise(p,size,MADV_HUGEPAGE);
+#endif
+    return p;
+}
+
+void md_freearena(void *p, U32B size)
+{
+
+    if (size<HUGEMIN) free(p);
+    else munmap(p,size);
+}
+
 char *md_tohapath(char *mdpath)
 {
 
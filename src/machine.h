@@ -28,8 +28,9 @@
 #define BETA "l"
 typedef short S16B;
 typedef unsigned short U16B;
-typedef long S32B;
-typedef unsigned long U32B;
+typedef long S32B;			/* At least 32 bits. Members and  */
+typedef unsigned long U32B;		/* archives over 4 GB need 64	  */
+typedef unsigned int U32T;		/* Exactly 32 bits, for tables	  */
 
 #define EXAMPLE "\n examples : ha a21r foo /bar/* , ha l foo , ha xy foo"
 #define ALLFILES "*"
@@ -57,8 +58,8 @@ extern struct stat filestat;
 void md_init(void);
 /* char *md_strcase(char *s); */
 char *md_arcname(char *name_req);
-void md_gethdr(int len, int mode);
-void md_puthdr(void);
+void md_gethdr(unsigned char *buf, int len, int mode);
+void md_puthdr(unsigned char *buf);	/* md_newfile() bytes */
 int md_newfile(void);
 int md_mkspecial(char *ofname,unsigned sdlen,unsigned char *sdata);
 int md_filetype(char *path,char *name);
@@ -66,6 +67,12 @@ void md_listhdr(void);
 void md_listdat(void);
 char *md_timestring(unsigned long t);
 void md_truncfile(int fh, U32B len);
+U32B md_copyrange(int fh, U32B from, U32B to, U32B len);
+unsigned char *md_mapfile(int fh, U32B len);	/* NULL if not possible */
+int md_mapok(unsigned char *map);		/* 0 if file shrank meanwhile */
+void md_unmapfile(unsigned char *map, U32B len);
+void *md_arena(U32B size);			/* NULL if not possible */
+void md_freearena(void *p, U32B size);
 char *md_tohapath(char *mdpath);
 char *md_tomdpath(char *hapath);
 char *md_strippath(char *mdfullpath);
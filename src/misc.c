@@ -27,6 +27,7 @@
 #include "error.h"
 
 typedef void (*Voidfunc)(void);
+typedef void (*Argfunc)(void *arg);
 
 struct culist
 {
@@ -34,6 +35,11 @@ struct culist
     {
         Voidfunc func;
         struct
+        {
+            Argfunc func;
+            void *arg;
+        } call;
+        struct
         {
             char *name;
             int handle;
@@ -45,6 +51,7 @@ struct culist
 
 int skipemptypath=0,sloppymatch=1;
 static struct culist cuhead= {{NULL},NULL,NULL,0};
+static struct culist *cufree=NULL;	/* Nodes for reuse		*/
 char **patterns;
 unsigned patcnt;
 
@@ -57,8 +64,9 @@ void testsizes(void)
 
     if (sizeof(U16B)!=2) error(0,ERR_SIZE,"U16B");
     if (sizeof(S16B)!=2) error(0,ERR_SIZE,"S16B");
-    if (sizeof(U32B)!=4) error(0,ERR_SIZE,"U32B");
-    if (sizeof(S32B)!=4) error(0,ERR_SIZE,"S32B");
+    if (sizeof(U32B)<4) error(0,ERR_SIZE,"U32B");	/* At least 32 bits */
+    if (sizeof(S32B)<4) error(0,ERR_SIZE,"S32B");
+    if (sizeof(U32T)!=4) error(0,ERR_SIZE,"U32T");
 }
 
 
@@ -74,11 +82,17 @@ void *cu_add(unsigned char flags, ...)
     char *string;
 
     mark=cuhead.next;
-    ptr=malloc(sizeof(struct culist));
-    if (ptr==NULL) error(1,ERR_MEM,"add_cleanup()");
+    if ((ptr=cufree)!=NULL) cufree=ptr->next;
+    else if ((ptr=malloc(sizeof(struct culist)))==NULL)
+        error(1,ERR_MEM,"add_cleanup()");
     ptr->flags=flags;
     va_start(vaptr,flags);
     if (flags&CU_FUNC) ptr->arg.func=va_arg(vaptr,Voidfunc);
+    else if (flags&CU_FUNCARG)
+    {
+        ptr->arg.call.func=va_arg(vaptr,Argfunc);
+        ptr->arg.call.arg=va_arg(vaptr,void *);
+    }
     else if ((flags&CU_RMFILE) || (flags&CU_RMDIR))
     {
         string=va_arg(vaptr,char *);
@@ -123,6 +137,11 @@ void cu_do(void *mark)
         {
             if (!(ptr->flags&CU_RELAXED)) ptr->arg.func();
         }
+        else if ((ptr->flags&CU_FUNCARG) && ptr->arg.call.func!=NULL)
+        {
+            if (!(ptr->flags&CU_RELAXED))
+                ptr->arg.call.func(ptr->arg.call.arg);
+        }
         else if ((ptr->flags&CU_RMFILE) && ptr->arg.fileinfo.name!=NULL)
         {
             close(ptr->arg.fileinfo.handle);
@@ -138,7 +157,8 @@ void cu_do(void *mark)
             free(ptr->arg.fileinfo.name);
         }
         cuhead.next=ptr->next;
-        free(ptr);
+        ptr->next=cufree;
+        cufree=ptr;
         ptr=cuhead.next;
     }
 }
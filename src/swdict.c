@@ -21,200 +21,423 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "ha.h"
 #include "haio.h"
+#include "codec.h"
 #include "swdict.h"
 #include "error.h"
 
-#define HSIZE	16384
-#define HSHIFT	3
-#define HASH(p) ((b[p]^((b[p+1]^(b[p+2]<<HSHIFT))<<HSHIFT))&(HSIZE-1))
-#define MAXCNT	1024
+/*	Positions are chained by a hash of their first 4 bytes. The
+	latest position for each 3 byte hash is kept separately, so that
+	short matches are found when the chain has nothing.
 
-U16B swd_bpos,swd_mlf;
-S16B swd_char;
-U16B cblen,binb;
-U16B bbf,bbl,inptr;
-U16B *ccnt=NULL,*ll=NULL,*cr=NULL,*best=NULL;
-unsigned char *b=NULL;
-U16B blen,iblen;
+	With SWD_TREE the positions of each 4 byte hash form a binary
+	search tree instead (as in the BT4 match finder of LZMA), which
+	finds the longest match in about logarithmic time even on very
+	repetitive data. Tree links hold absolute positions (pos) so
+	that nodes which have left the window are recognized.
+*/
 
-void swd_cleanup(void)
+#define HBITS	16			/* Hash size for small windows	*/
+#define MAXHBITS 24
+#define HASH(p) ((U32B)(((((U32B)b[p]|(U32B)b[p+1]<<8|(U32B)b[p+2]<<16|\
+			   (U32B)b[p+3]<<24)*2654435761UL)&0xffffffffUL)>>\
+			(32-sw->hbits)))
+#define H3SIZE	16384
+#define H3SHIFT	3
+#define HASH3(p) ((b[p]^((b[p+1]^(b[p+2]<<H3SHIFT))<<H3SHIFT))&(H3SIZE-1))
+
+static struct
+{
+    U16B maxcnt;			/* Chain positions to check	*/
+    U16B nice;				/* Stop at a match this long	*/
+    int prune;				/* Stop where best[] says so	*/
+    int tree;				/* Use binary tree		*/
+} effort[]=
+{
+    {0,0,0,0},
+    {16,32,1,0},			/* SWD_FAST			*/
+    {1024,0xffff,1,0},			/* SWD_NORMAL			*/
+    {4096,0xffff,0,0},			/* SWD_MAX			*/
+    {256,0xffff,0,1}			/* SWD_TREE (tree depth)	*/
+};
+
+void swd_effort(Codec *cx, int l)
 {
 
-    if (ccnt!=NULL) free(ccnt),ccnt=NULL;
-    if (ll!=NULL) free(ll),ll=NULL;
-    if (cr!=NULL) free(cr),cr=NULL;
-    if (b!=NULL) free(b),b=NULL;
-    if (best!=NULL) free(best),best=NULL;
+    cx->effort=l;
+}
+
+static U16B matchlen(unsigned char *p1, unsigned char *p2, U16B max)
+{
+
+    register U16B i;
+    unsigned long w1,w2;
+
+    for (i=0; i+sizeof(w1)<=max; i+=sizeof(w1))
+    {
+        memcpy(&w1,p1+i,sizeof(w1));
+        memcpy(&w2,p2+i,sizeof(w2));
+        if (w1!=w2) break;
+    }
+    while (i<max && p1[i]==p2[i]) ++i;
+    return i;
 }
 
-void swd_init(U16B maxl, U16B bufl)
+static U16B tree_insert(Swd *sw, U32B *mpos)	/* Returns longest match */
+{
+
+    register unsigned char *b=sw->b;
+    register U16B len;
+    register U32B idx;
+    U16B lim=sw->bbl,len0,len1,maxlen,depth;
+    U32B bbf=sw->bbf,h;
+    U32T cur=sw->pos,m,delta,*p0,*p1,*pair;
+
+    h=HASH(bbf);
+    m=sw->th[h];
+    sw->th[h]=cur;
+    p0=sw->son+2*bbf+1;
+    p1=sw->son+2*bbf;
+    len0=len1=maxlen=0;
+    for (depth=effort[sw->level].maxcnt;;)
+    {
+        delta=cur-m;
+        if (depth--==0 || delta==0 || delta>sw->binb)
+        {
+            *p0=*p1=0;
+            break;
+        }
+        idx=bbf>=delta?bbf-delta:bbf+sw->blen-delta;
+        pair=sw->son+2*idx;
+        len=len0<len1?len0:len1;
+        if (b[idx+len]==b[bbf+len])
+        {
+            len+=matchlen(b+idx+len,b+bbf+len,lim-len);
+            if (len>maxlen)
+            {
+                maxlen=len;
+                *mpos=idx;
+            }
+            if (len==lim)
+            {
+                *p1=pair[0];
+                *p0=pair[1];
+                break;
+            }
+        }
+        if (b[idx+len]<b[bbf+len])
+        {
+            *p1=m;
+            p1=pair+1;
+            m=*p1;
+            len1=len;
+        }
+        else
+        {
+            *p0=m;
+            p0=pair;
+            m=*p0;
+            len0=len;
+        }
+    }
+    return maxlen;
+}
+
+/*	The tables of a run are carved from one arena, which stays in the
+	context for the next run unless it is larger than KEEPMAX. Tables
+	that were allocated with calloc() before are cleared.
+*/
+
+#define KEEPMAX	(16UL<<20)
+
+void swd_free(Codec *cx)
+{
+
+    register Swd *sw=cx->swd;
+
+    if (sw==NULL) return;
+    if (sw->arena!=NULL) md_freearena(sw->arena,sw->alen);
+    free(sw);
+    cx->swd=NULL;
+}
+
+void swd_cleanup(Codec *cx)
+{
+
+    if (cx->swd!=NULL && cx->swd->alen>KEEPMAX) swd_free(cx);
+}
+
+static Swd *swd_alloc(Codec *cx, U32B size)
+{
+
+    register Swd *sw=cx->swd;
+    void *arena=NULL;
+    U32B alen=0;
+
+    if (sw!=NULL)
+    {
+        arena=sw->arena;
+        alen=sw->alen;
+    }
+    else if ((sw=cx->swd=malloc(sizeof(Swd)))==NULL)
+        error(1,ERR_MEM,"swd_alloc()");
+    memset(sw,0,sizeof(Swd));
+    if (arena!=NULL && alen<size)
+    {
+        md_freearena(arena,alen);
+        arena=NULL;
+    }
+    if (arena==NULL)
+    {
+        if ((arena=md_arena(size))==NULL)
+        {
+            swd_free(cx);
+            error(1,ERR_MEM,"swd_alloc()");
+        }
+        alen=size;
+    }
+    sw->arena=arena;
+    sw->alen=alen;
+    return sw;
+}
+
+void swd_init(Codec *cx, U16B maxl, U32B bufl)
 {
 
     register S16B i;
+    register Swd *sw;
+    register unsigned char *b;
+    U32B blen,hsize;
+    U32T *p;
+    int hbits,tree=effort[cx->effort].tree;
 
-    iblen=maxl;
-    cblen=bufl;
-    blen=cblen+iblen;
-    ll=malloc(blen*sizeof(*ll));
-    best=malloc(blen*sizeof(*best));
-    ccnt=malloc(HSIZE*sizeof(*ccnt));
-    cr=malloc(HSIZE*sizeof(*cr));
-    b=malloc((blen+iblen-1)*sizeof(*b));
-    if (ll==NULL || ccnt==NULL || cr==NULL || b==NULL)
+    blen=bufl+maxl;
+    for (hbits=HBITS; hbits<MAXHBITS && 4UL<<hbits<bufl;) ++hbits;
+    hsize=1UL<<hbits;
+    sw=swd_alloc(cx,(blen+2*hsize+H3SIZE+(tree?hsize+2*blen:0))*
+                 sizeof(U32T)+blen*sizeof(U16B)+blen+maxl-1);
+    sw->level=cx->effort;
+    sw->iblen=maxl;
+    sw->cblen=bufl;
+    sw->blen=blen;
+    sw->hbits=hbits;
+    p=sw->arena;
+    sw->ll=p;
+    sw->ccnt=p+=blen;
+    sw->cr=p+=hsize;
+    sw->cr3=p+=hsize;
+    p+=H3SIZE;
+    if (tree)
     {
-        swd_cleanup();
-        error(1,ERR_MEM,"swd_init()");
+        sw->th=p;
+        sw->son=p+=hsize;
+        p+=2*blen;
     }
-    for (i=0; i<HSIZE; ++i) ccnt[i]=0;
-    binb=bbf=bbl=inptr=0;
-    while (bbl<iblen)
+    sw->best=(U16B *)p;
+    sw->b=(unsigned char *)(sw->best+blen);
+    memset(sw->ccnt,0,hsize*sizeof(*sw->ccnt));
+    memset(sw->cr3,0,H3SIZE*sizeof(*sw->cr3));
+    if (tree) memset(sw->th,0,hsize*sizeof(*sw->th));
+    sw->pos=sw->blen;
+    sw->binb=sw->bbf=sw->bbl=sw->inptr=0;
+    b=sw->b;
+    while (sw->bbl<sw->iblen)
     {
-        if ((i=getbyte())<0) break;
-        b[inptr++]=i;
-        bbl++;
+        if ((i=getbyte(&cx->io))<0) break;
+        b[sw->inptr++]=i;
+        sw->bbl++;
     }
-    swd_mlf=MINLEN-1;
+    memset(b+sw->inptr,0,sw->iblen-sw->bbl);
+    sw->mlf=MINLEN-1;
 }
 
-#ifndef PCASM
+/*	Past the end of input, hashes still read up to 3 bytes ahead.
+	These are cleared so that the output does not depend on what an
+	earlier run left in the buffer.
+*/
+
+static void endbyte(Swd *sw)
+{
+
+    if (sw->inptr<sw->iblen-1) sw->b[sw->inptr+sw->blen]=0;
+    sw->b[sw->inptr]=0;
+    if (++sw->inptr==sw->blen) sw->inptr=0;
+}
 
-void swd_accept(void)
+void swd_accept(Codec *cx)
 {
 
     register S16B i,j;
+    register U32B h;
+    register Swd *sw=cx->swd;
+    register unsigned char *b=sw->b;
+    U32B tpos;
+    int tree=effort[sw->level].tree;
 
-    j=swd_mlf-2;
+    j=sw->mlf-2;
     do     		/* Relies on non changed swd_mlf !!! */
     {
-        if (binb==cblen) --ccnt[HASH(inptr)];
-        else ++binb;
-        i=HASH(bbf);
-        ll[bbf]=cr[i];
-        cr[i]=bbf;
-        best[bbf]=30000;
-        ccnt[i]++;
-        if (++bbf==blen) bbf=0;
-        if ((i=getbyte())<0)
+        if (tree)
+        {
+            if (sw->bbl>=4) tree_insert(sw,&tpos);
+            if (sw->binb<sw->cblen) ++sw->binb;
+        }
+        else
+        {
+            if (sw->binb==sw->cblen) --sw->ccnt[HASH(sw->inptr)];
+            else ++sw->binb;
+            h=HASH(sw->bbf);
+            sw->ll[sw->bbf]=sw->cr[h];
+            sw->cr[h]=sw->bbf;
+            sw->ccnt[h]++;
+        }
+        ++sw->pos;
+        sw->cr3[HASH3(sw->bbf)]=sw->bbf;
+        sw->best[sw->bbf]=30000;
+        if (++sw->bbf==sw->blen) sw->bbf=0;
+        if ((i=getbyte(&cx->io))<0)
         {
-            --bbl;
-            if(++inptr==blen) inptr=0;
+            --sw->bbl;
+            endbyte(sw);
             continue;
         }
-        if (inptr<iblen-1)
+        if (sw->inptr<sw->iblen-1)
         {
-            b[inptr+blen]=b[inptr]=i;
-            ++inptr;
+            b[sw->inptr+sw->blen]=b[sw->inptr]=i;
+            ++sw->inptr;
         }
         else
         {
-            b[inptr]=i;
-            if(++inptr==blen) inptr=0;
+            b[sw->inptr]=i;
+            if(++sw->inptr==sw->blen) sw->inptr=0;
         }
     }
     while (--j);
-    swd_mlf=MINLEN-1;
+    sw->mlf=MINLEN-1;
 }
 
-void swd_findbest(void)
+void swd_findbest(Codec *cx)
 {
 
-    register U16B i,ref,cnt,ptr,start_len;
+    register U16B i,ref,start_len;
+    register U32B h,cnt,ptr;
     register S16B c;
+    register Swd *sw=cx->swd;
+    register unsigned char *b=sw->b;
+    U16B bbl=sw->bbl,tlen=0,nice=effort[sw->level].nice;
+    U32B bbf=sw->bbf,p3,tpos;
+    int prune=effort[sw->level].prune,tree=effort[sw->level].tree;
 
-    i=HASH(bbf);
-    if ((cnt=ccnt[i]++)>MAXCNT) cnt=MAXCNT;
-    ptr=ll[bbf]=cr[i];
-    cr[i]=bbf;
-    swd_char=b[bbf];
-    if ((start_len=swd_mlf)>=bbl)
+    if (tree)
+    {
+        cnt=0;
+        if (bbl>=4) tlen=tree_insert(sw,&tpos);
+    }
+    else
+    {
+        h=HASH(bbf);
+        if ((cnt=sw->ccnt[h]++)>effort[sw->level].maxcnt)
+            cnt=effort[sw->level].maxcnt;
+        ptr=sw->ll[bbf]=sw->cr[h];
+        sw->cr[h]=bbf;
+    }
+    i=HASH3(bbf);
+    p3=sw->cr3[i];
+    sw->cr3[i]=bbf;
+    sw->chr=b[bbf];
+    if ((start_len=sw->mlf)>=bbl)
     {
-        if (bbl==0) swd_char=-1;
-        best[bbf]=30000;
+        if (bbl==0) sw->chr=-1;
+        sw->best[bbf]=30000;
     }
     else
     {
-        for (ref=b[bbf+swd_mlf-1]; cnt--; ptr=ll[ptr])
+        if (tlen>sw->mlf)
         {
-            if (b[ptr+swd_mlf-1]==ref &&
-                    b[ptr]==b[bbf] && b[ptr+1]==b[bbf+1])
-            {
-                {
-                    register unsigned char *p1=b+ptr+3,*p2=b+bbf+3;
-                    for (i=3; i<bbl; ++i)
-                    {
-                        if (*p1++!=*p2++) break;
-                    }
-                }
-                if (i<=swd_mlf) continue;
-                swd_bpos=ptr;
-                if ((swd_mlf=i)==bbl || best[ptr]<i) break;
-                ref=b[bbf+swd_mlf-1];
-            }
+            sw->bpos=tpos;
+            sw->mlf=tlen;
         }
-        best[bbf]=swd_mlf;
-        if (swd_mlf>start_len)
+        for (ref=b[bbf+sw->mlf]; cnt--; ptr=sw->ll[ptr])
         {
-            if (swd_bpos<bbf) swd_bpos=bbf-swd_bpos-1;
-            else swd_bpos=blen-1-swd_bpos+bbf;
+            if (b[ptr+sw->mlf]!=ref || b[ptr]!=b[bbf]) continue;
+            if ((i=matchlen(b+ptr,b+bbf,bbl))<=sw->mlf) continue;
+            sw->bpos=ptr;
+            if ((sw->mlf=i)==bbl || i>=nice || (prune && sw->best[ptr]<i))
+                break;
+            ref=b[bbf+sw->mlf];
+        }
+        if (sw->mlf==start_len &&
+                (p3<bbf?bbf-p3-1:sw->blen-1-p3+bbf)<sw->binb &&
+                (i=matchlen(b+p3,b+bbf,bbl))>sw->mlf)
+        {
+            sw->bpos=p3;
+            sw->mlf=i;
+        }
+        sw->best[bbf]=sw->mlf;
+        if (sw->mlf>start_len)
+        {
+            if (sw->bpos<bbf) sw->bpos=bbf-sw->bpos-1;
+            else sw->bpos=sw->blen-1-sw->bpos+bbf;
         }
     }
-    if (binb==cblen) --ccnt[HASH(inptr)];
-    else ++binb;
-    if (++bbf==blen) bbf=0;
-    if ((c=getbyte())<0)
+    if (sw->binb<sw->cblen) ++sw->binb;
+    else if (!tree) --sw->ccnt[HASH(sw->inptr)];
+    ++sw->pos;
+    if (++sw->bbf==sw->blen) sw->bbf=0;
+    if ((c=getbyte(&cx->io))<0)
     {
-        --bbl;
-        if(++inptr==blen) inptr=0;
+        --sw->bbl;
+        endbyte(sw);
         return;
     }
-    if (inptr<iblen-1)
+    if (sw->inptr<sw->iblen-1)
     {
-        b[inptr+blen]=b[inptr]=c;
-        ++inptr;
+        b[sw->inptr+sw->blen]=b[sw->inptr]=c;
+        ++sw->inptr;
     }
     else
     {
-        b[inptr]=c;
-        if (++inptr==blen) inptr=0;
+        b[sw->inptr]=c;
+        if (++sw->inptr==sw->blen) sw->inptr=0;
     }
 }
 
-#endif
-
-void swd_dinit(U16B bufl)
+void swd_dinit(Codec *cx, U32B bufl)
 {
 
-    cblen=bufl;
-    b=malloc(cblen*sizeof(unsigned char));
-    if (b==NULL)
-    {
-        swd_cleanup();
-        error(1,ERR_MEM,"swd_dinit()");
-    }
-    bbf=0;
+    register Swd *sw=swd_alloc(cx,bufl);
+
+    sw->cblen=bufl;
+    sw->b=sw->arena;
+    sw->bbf=0;
 }
 
 
-void swd_dpair(U16B l, U16B p)
+void swd_dpair(Codec *cx, U16B l, U32B p)
 {
 
-    if (bbf>p) p=bbf-1-p;
-    else p=cblen-1-p+bbf;
+    register Swd *sw=cx->swd;
+    register unsigned char *b=sw->b;
+
+    if (sw->bbf>p) p=sw->bbf-1-p;
+    else p=sw->cblen-1-p+sw->bbf;
     while (l--)
     {
-        b[bbf]=b[p];
-        putbyte(b[p]);
-        if (++bbf==cblen) bbf=0;
-        if (++p==cblen) p=0;
+        b[sw->bbf]=b[p];
+        putbyte(&cx->io,b[p]);
+        if (++sw->bbf==sw->cblen) sw->bbf=0;
+        if (++p==sw->cblen) p=0;
     }
 }
 
-void swd_dchar(S16B c)
+void swd_dchar(Codec *cx, S16B c)
 {
 
-    b[bbf]=c;
-    putbyte(c);
-    if (++bbf==cblen) bbf=0;
+    register Swd *sw=cx->swd;
+
+    sw->b[sw->bbf]=c;
+    putbyte(&cx->io,c);
+    if (++sw->bbf==sw->cblen) sw->bbf=0;
 }
@@ -19,19 +19,41 @@
 	HA sliding window dictionary
 ***********************************************************************/
 
-void swd_init(U16B maxl, U16B bufl);	/* maxl=max len to be found  */
-/* bufl=dictionary buffer len */
-/* bufl+2*maxl-1<32768 !!! */
-void swd_cleanup(void);
-void swd_accept(void);
-void swd_findbest(void);
-void swd_dinit(U16B bufl);
-void swd_dpair(U16B l, U16B p);
-void swd_dchar(S16B c);
-
 #define MINLEN 	3	/* Minimum possible match lenght for this */
 /* implementation */
 
-extern U16B swd_bpos,swd_mlf;
-extern S16B swd_char;
+typedef struct swdstate			/* Dictionary state		*/
+{
+    U32B bpos;				/* Best match position		*/
+    U16B mlf;				/* Best match length		*/
+    S16B chr;				/* Current character (-1 = end)	*/
+    U32B cblen,binb;
+    U32B bbf,inptr;
+    U16B bbl;
+    U32T *ccnt,*ll,*cr,*cr3;		/* Window positions, below 4 GB	*/
+    U16B *best;
+    U32T *th,*son,pos;			/* Binary tree (SWD_TREE)	*/
+    unsigned char *b;
+    U32B blen;
+    U16B iblen;
+    int hbits;				/* Hash table is 1<<hbits	*/
+    int level;				/* Effort of this run		*/
+    void *arena;			/* Holds all tables above	*/
+    U32B alen;
+} Swd;
 
+#define SWD_FAST	1	/* Match finder effort levels	*/
+#define SWD_NORMAL	2
+#define SWD_MAX		3
+#define SWD_TREE	4
+
+void swd_effort(Codec *cx, int level);	/* Set for following runs in cx */
+void swd_init(Codec *cx, U16B maxl, U32B bufl);	/* maxl=max len to be found  */
+/* bufl=dictionary buffer len */
+void swd_cleanup(Codec *cx);	/* After a run, tables may be kept */
+void swd_free(Codec *cx);
+void swd_accept(Codec *cx);
+void swd_findbest(Codec *cx);
+void swd_dinit(Codec *cx, U32B bufl);
+void swd_dpair(Codec *cx, U16B l, U32B p);
+void swd_dchar(Codec *cx, S16B c);
@@ -0,0 +1,181 @@
+/***********************************************************************
+  This file is part of HA, a general purpose file archiver.
+  Copyright (C) 1995 Harri Hirvola
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+************************************************************************
+	HA ordered work queue
+***********************************************************************/
+
+#include <stdlib.h>
+#include <pthread.h>
+#include "ha.h"
+#include "haio.h"
+#include "codec.h"
+#include "workq.h"
+#include "error.h"
+
+struct slot
+{
+    void *job;
+    int done;
+    Errtrap err;			/* Fatal error of the job	*/
+};
+
+struct workq
+{
+    pthread_mutex_t lock;
+    pthread_cond_t todo,ready;
+    pthread_t tid[MAXTHREADS];
+    int threads,window,busy;
+    struct slot *ring;
+    unsigned first,next,taken;	/* Oldest, free and first untaken slot */
+    int stop;
+    void (*work)(Codec *cx, void *job);
+};
+
+static void *worker(void *arg)
+{
+
+    Workq *q=arg;
+    Codec cx;
+    Errtrap trap;
+    struct slot *s;
+
+    codec_init(&cx);
+    error_trap(&trap);
+    pthread_mutex_lock(&q->lock);
+    for (;;)
+    {
+        while (q->taken==q->next && !q->stop)
+            pthread_cond_wait(&q->todo,&q->lock);
+        if (q->taken==q->next) break;
+        s=q->ring+q->taken++%q->window;
+        ++q->busy;
+        pthread_mutex_unlock(&q->lock);
+        trap.number=0;
+        if (setjmp(trap.env)==0) (*q->work)(&cx,s->job);
+        else				/* Left mid run, start anew	*/
+        {
+            codec_cleanup(&cx);
+            codec_init(&cx);
+        }
+        pthread_mutex_lock(&q->lock);
+        if (trap.number) s->err=trap;
+        --q->busy;
+        s->done=1;
+        pthread_cond_broadcast(&q->ready);
+    }
+    pthread_mutex_unlock(&q->lock);
+    codec_cleanup(&cx);
+    return NULL;
+}
+
+Workq *wq_new(int threads, int window, void (*work)(Codec *cx, void *job))
+{
+
+    Workq *q;
+    int i;
+
+    if (threads>MAXTHREADS) threads=MAXTHREADS;
+    if (window<threads) window=threads;
+    if ((q=malloc(sizeof(Workq)))==NULL ||
+            (q->ring=malloc(window*sizeof(struct slot)))==NULL)
+        error(1,ERR_MEM,"wq_new()");
+    pthread_mutex_init(&q->lock,NULL);
+    pthread_cond_init(&q->todo,NULL);
+    pthread_cond_init(&q->ready,NULL);
+    q->threads=threads;
+    q->window=window;
+    q->first=q->next=q->taken=q->busy=0;
+    q->stop=0;
+    q->work=work;
+    for (i=0; i<threads; ++i)
+    {
+        if (pthread_create(q->tid+i,NULL,worker,q)!=0)
+            error(1,ERR_THREAD,"wq_new()");
+    }
+    return q;
+}
+
+int wq_full(Workq *q)
+{
+
+    return q->next-q->first==q->window;
+}
+
+void wq_submit(Workq *q, void *job)
+{
+
+    struct slot *s;
+
+    pthread_mutex_lock(&q->lock);
+    s=q->ring+q->next++%q->window;
+    s->job=job;
+    s->done=0;
+    s->err.number=0;
+    pthread_cond_signal(&q->todo);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void *wq_next(Workq *q)
+{
+
+    struct slot *s;
+
+    if (q->first==q->next) return NULL;
+    s=q->ring+q->first%q->window;
+    pthread_mutex_lock(&q->lock);
+    while (!s->done) pthread_cond_wait(&q->ready,&q->lock);
+    ++q->first;
+    if (s->err.number)		/* Stop the workers, then report */
+    {
+        q->taken=q->next;
+        while (q->busy) pthread_cond_wait(&q->ready,&q->lock);
+        pthread_mutex_unlock(&q->lock);
+        error_raise(&s->err);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return s->job;
+}
+
+void wq_idle(Workq *q)
+{
+
+    unsigned i;
+
+    pthread_mutex_lock(&q->lock);
+    for (i=q->first; i!=q->next; ++i)
+        while (!q->ring[i%q->window].done)
+            pthread_cond_wait(&q->ready,&q->lock);
+    pthread_mutex_unlock(&q->lock);
+}
+
+void wq_free(Workq *q)
+{
+
+    int i;
+
+    pthread_mutex_lock(&q->lock);
+    q->stop=1;
+    pthread_cond_broadcast(&q->todo);
+    pthread_mutex_unlock(&q->lock);
+    for (i=0; i<q->threads; ++i) pthread_join(q->tid[i],NULL);
+    pthread_cond_destroy(&q->ready);
+    pthread_cond_destroy(&q->todo);
+    pthread_mutex_destroy(&q->lock);
+    free(q->ring);
+    free(q);
+}
@@ -0,0 +1,42 @@
+/***********************************************************************
+  This file is part of HA, a general purpose file archiver.
+  Copyright (C) 1995 Harri Hirvola
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, write to the Free Software
+  Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+************************************************************************
+	HA ordered work queue
+***********************************************************************/
+
+/*	Jobs are handed to a pool of worker threads, each of which owns
+	a private codec context. Finished jobs are returned by wq_next()
+	strictly in the order they were submitted, so the caller can
+	commit results deterministically from a single thread. Only
+	that thread may call wq_submit()/wq_next(), and it must retire
+	the oldest job with wq_next() before submitting when wq_full().
+	A fatal error in a job does not end the process from the worker:
+	wq_next() reports it when that job's turn comes, after the other
+	workers have stopped.
+*/
+
+#define MAXTHREADS	64		/* Upper limit for worker count	*/
+
+typedef struct workq Workq;
+
+Workq *wq_new(int threads, int window, void (*work)(Codec *cx, void *job));
+int wq_full(Workq *q);
+void wq_submit(Workq *q, void *job);
+void *wq_next(Workq *q);
+void wq_idle(Workq *q);			/* Wait for jobs, keep them	*/
+void wq_free(Workq *q);